@@ -1,6 +1,7 @@
 import serial
+import time
 from struct import unpack, calcsize, pack
-from enum import IntEnum
+from enum import IntEnum, IntFlag
 from typing import Optional
 
 
@@ -16,6 +17,8 @@ class HostError(IntEnum):
     program_error = 8
     dropping_data = 9
     timed_out = 10
+    overflow = 11
+    coalesced = 12
 
 
 class HostCode(IntEnum):
@@ -23,6 +26,11 @@ class HostCode(IntEnum):
     stream_marker = 1
     comm = 2
     echo = 3
+    clock_sync = 4
+    scheduled = 5
+    trigger = 6
+    journal = 7
+    telemetry = 8
 
 
 class ModIOCmd(IntEnum):
@@ -33,6 +41,11 @@ class ModIOCmd(IntEnum):
     read_dig = 4
     write_dig = 5
     address_change = 6
+    read_dig_edges_start = 7
+    poll_stats = 8
+    queue_stats = 9
+    write_dig_pulse = 10
+    health = 11
 
 
 class ModIOPullup(IntEnum):
@@ -48,10 +61,226 @@ class ModIOFreq(IntEnum):
     freq_1m = 2
 
 
+class ModIOLane(IntEnum):
+    """Priority classes of the queued requests. ``write_dig`` and
+    ``write_dig_pulse`` are urgent."""
+    urgent = 0
+    normal = 1
+
+
+class ModIODevice(IntEnum):
+    """The I2C device a board is. A ``pcf8574`` port drives the relays on
+    P0-P3 and reads the inputs on P4-P7, and its address can't be changed.
+    """
+    mod_io = 0
+    pcf8574 = 1
+
+
+class ModIOHealth(IntEnum):
+    """A board is ``failing`` after a failed transaction and ``failed``
+    after several in a row. Only timeouts and lines held low also make the
+    device recover the board's port, a board that NAKs doesn't."""
+    ok = 0
+    failing = 1
+    failed = 2
+
+
+class ModIOFlags(IntFlag):
+    none = 0
+    timestamps = 1
+    coalesce = 2
+    read_stop = 4
+
+
 class MarkerCmd(IntEnum):
     enable = 0
     disable = 1
     mark = 2
+    stats = 3
+    enable_parallel = 4
+
+
+class JournalCmd(IntEnum):
+    enable = 0
+    disable = 1
+    dump = 2
+    event = 3
+
+
+class TriggerCmd(IntEnum):
+    add = 0
+    remove = 1
+    clear = 2
+    arm = 3
+    fired = 4
+
+
+class TelemetryCmd(IntEnum):
+    host = 0
+    board = 1
+    push = 2
+    profile = 3
+    profile_reset = 4
+
+
+class ProfilePoint(IntEnum):
+    """The scopes timed by firmware built with ``PROFILE_ENABLED``."""
+    host_comm_loop = 0
+    send_to_host = 1
+    flush_to_host = 2
+    modio_loop = 3
+    marker_loop = 4
+
+
+class TriggerFlags(IntFlag):
+    none = 0
+    armed = 1
+    once = 2
+
+
+class ClockSync:
+    """Maps the device ``micros()`` onto the host ``time.monotonic()``.
+
+    Each ping-pong exchange gives the device time at the host midpoint of the
+    round trip. A line is fitted to those samples with exponential
+    forgetting, so the offset and drift follow the clocks over long sessions.
+    Exchanges whose round trip is much longer than the best recent one were
+    likely delayed on the way and are skipped.
+    """
+
+    forget = 0.99
+    """Weight of the previous samples relative to a new one."""
+
+    max_rtt_ratio = 2.
+    """Samples with a round trip this many times the best one are skipped.
+    """
+
+    min_rtt_decay = 1.01
+    """How fast the best round trip relaxes, so a change of path is
+    followed."""
+
+    def __init__(self):
+        self.reset()
+
+    def reset(self):
+        self.samples = 0
+        self.min_rtt = None
+        self.last_device_us = None
+        self._x0 = self._y0 = None
+        self._sw = self._sx = self._sy = self._sxx = self._sxy = 0.
+
+    def add_sample(
+            self, host_sent: float, host_received: float, device_us: int
+    ) -> bool:
+        """Adds one exchange, with the host times in seconds. Returns whether
+        it was used.
+        """
+        rtt = host_received - host_sent
+        if self.min_rtt is None or rtt < self.min_rtt:
+            self.min_rtt = rtt
+        else:
+            self.min_rtt *= self.min_rtt_decay
+        if rtt > self.min_rtt * self.max_rtt_ratio and self.samples:
+            return False
+
+        if self._x0 is None:
+            self._x0 = device_us
+            self._y0 = host_sent + rtt / 2
+
+        # relative to the first sample so the sums keep their precision
+        x = (device_us - self._x0) / 1e6
+        y = host_sent + rtt / 2 - self._y0
+        f = self.forget
+        self._sw = self._sw * f + 1
+        self._sx = self._sx * f + x
+        self._sy = self._sy * f + y
+        self._sxx = self._sxx * f + x * x
+        self._sxy = self._sxy * f + x * y
+
+        self.samples += 1
+        self.last_device_us = device_us
+        return True
+
+    @property
+    def drift(self) -> float:
+        """Host seconds per device second, minus 1."""
+        det = self._sw * self._sxx - self._sx * self._sx
+        # until the samples span some time, assume the clocks run together
+        if self.samples < 2 or det <= 1e-12 * self._sw * self._sw:
+            return 0.
+        return (self._sw * self._sxy - self._sx * self._sy) / det - 1
+
+    def to_host(self, device_us: int) -> float:
+        """Host monotonic time in seconds of the device time."""
+        if not self.samples:
+            raise ValueError("The clock was not synced yet")
+
+        slope = 1 + self.drift
+        x_mean = self._sx / self._sw
+        y_mean = self._sy / self._sw
+        x = (device_us - self._x0) / 1e6
+        return self._y0 + y_mean + slope * (x - x_mean)
+
+    def to_device(self, host_time: float) -> int:
+        """Device time in microseconds of the host monotonic time, e.g. for
+        ``make_scheduled``."""
+        if not self.samples:
+            raise ValueError("The clock was not synced yet")
+
+        slope = 1 + self.drift
+        x_mean = self._sx / self._sw
+        y_mean = self._sy / self._sw
+        x = (host_time - self._y0 - y_mean) / slope + x_mean
+        return self._x0 + round(x * 1e6)
+
+    def unwrap(self, device_us32: int) -> int:
+        """Extends a 32-bit device time, e.g. ``done_us``, to 64 bits using
+        the latest sync, to which it must be within about 35 minutes.
+        """
+        if self.last_device_us is None:
+            raise ValueError("The clock was not synced yet")
+
+        ref = self.last_device_us
+        delta = (device_us32 - ref) & 0xFFFFFFFF
+        if delta >= 1 << 31:
+            delta -= 1 << 32
+        return ref + delta
+
+
+class JournalTracker:
+    """Follows the sequence numbers of the journal events, to find those
+    that were dropped on the way and ask for them with
+    ``TeensyComm.make_journal_dump``.
+    """
+
+    def __init__(self):
+        self.next_seq = 0
+        self.missing = set()
+
+    def add(self, seq: int) -> bool:
+        """Adds a received event. Returns whether it's new, dumped events
+        may already have been received."""
+        if seq >= self.next_seq:
+            self.missing.update(range(self.next_seq, seq))
+            self.next_seq = seq + 1
+            return True
+        if seq in self.missing:
+            self.missing.remove(seq)
+            return True
+        return False
+
+    def dump_done(self, from_seq: int, n: int):
+        """The events before ``from_seq + n`` that are still missing were
+        overwritten on the device, and are given up."""
+        self.missing = {seq for seq in self.missing if seq >= from_seq + n}
+
+    def missing_range(self) -> Optional[tuple[int, int]]:
+        """The ``from_seq`` and ``n`` that cover all the missing events, to
+        dump them at once, or None."""
+        if not self.missing:
+            return None
+        first = min(self.missing)
+        return first, max(self.missing) - first + 1
 
 
 class TeensyComm:
@@ -60,20 +289,99 @@ class TeensyComm:
 
     _host_comm_f = 'BBBB'
 
+    # every frame to the device is sent as this, the frame and its crc8
+    _host_sync = 0xA5
+
     _modio_data_f = 'BBB'
 
-    _modio_create_f = 'BB'
+    _modio_create_f = 'BBBLBBB'
 
     _modio_data_buff_f = 'BB'
 
+    _modio_inputs_n = 4
+
+    _modio_cont_f = 'L'
+
+    _modio_edges_f = 'BB4BL'
+
+    _modio_poll_stats_f = 'LLLLL'
+
+    _modio_health_f = 'BBHL'
+
+    _modio_wait_stats_f = 'LLL'
+
+    _modio_edge_f = 'BBL'
+
+    # sent by boards created with ModIOFlags.timestamps
+    _modio_data_ts_f = 'LL'
+
+    _modio_pulse_f = 'LLH'
+
+    # follows _modio_data_ts_f in the write_dig_pulse acks
+    _modio_pulse_ts_f = 'H'
+
     _marker_data_f = 'B'
 
-    _marker_enable_f = 'LBB'
+    # the struct aligns duration to 4 bytes and its size to a multiple of 4
+    _marker_enable_f = '3xLBB2x'
+
+    _marker_parallel_bits_n = 8
+
+    _marker_enable_parallel_f = '3xLB8B3x'
 
     _marker_item_f = 'B'
 
+    _marker_stats_f = 'LLLB'
+
+    _clock_sync_f = 'Q'
+
+    _scheduled_f = 'Q'
+
+    _scheduled_done_f = 'QQ'
+
+    _scheduled_frame_n = 32
+
+    _journal_data_f = 'B'
+
+    _journal_dump_f = 'LL'
+
+    _journal_event_f = 'LL'
+
+    _trigger_data_f = 'BB'
+
+    _trigger_add_f = 'BBBBB'
+
+    _trigger_arm_f = 'L'
+
+    _trigger_fired_f = 'BBL'
+
+    _trigger_frame_n = 24
+
+    _telemetry_data_f = 'B'
+
+    _telemetry_host_f = 'LLLLLHLLLL'
+
+    _telemetry_board_f = 'BB'
+
+    _telemetry_board_stats_f = 'LLL'
+
+    # max and mean_x100 of each ModIOLane
+    _telemetry_queue_f = 'BH'
+
+    _telemetry_latency_bins_n = 8
+
+    _telemetry_push_f = 'L'
+
+    _telemetry_profile_f = 'B'
+
+    _telemetry_profile_stats_f = 'HLLQ'
+
+    _profile_bins_n = 16
+
     _buffer = b''
 
+    clock: ClockSync = None
+
     def create_serial_device(self, name: str):
         self._ser = serial.Serial(name)
         # self._ser.open()
@@ -85,8 +393,36 @@ class TeensyComm:
         self._ser.close()
         self._ser = None
 
+    @staticmethod
+    def crc8(data: bytes) -> int:
+        """CRC-8 with polynomial 0x07 and initial value 0, as the device
+        checks it."""
+        crc = 0
+        for byte in data:
+            crc ^= byte
+            for _ in range(8):
+                crc = ((crc << 1) ^ 0x07 if crc & 0x80 else crc << 1) & 0xFF
+        return crc
+
+    def frame_bytes(self, data: bytes) -> bytes:
+        """Wraps each of the frames made by the ``make_`` methods in ``data``
+        in the sync byte and CRC the device expects. The device skips
+        anything that fails them."""
+        out = b''
+        i = 0
+        while i < len(data):
+            n = data[i]
+            if not n:
+                raise ValueError("Frame has no length")
+            frame = data[i:i + n]
+            out += bytes([self._host_sync]) + frame + \
+                bytes([self.crc8(frame)])
+            i += n
+        return out
+
     def write_serial(self, data: bytes):
-        self._ser.write(data)
+        """Sends one or more frames made by the ``make_`` methods."""
+        self._ser.write(self.frame_bytes(data))
 
     def read_serial(self, size: Optional[int] = None):
         if size is None:
@@ -108,20 +444,247 @@ class TeensyComm:
             HostError.no_error.value
         )
 
+    def make_clock_sync(self, id_val: int):
+        fmt = '<' + self._host_comm_f
+        return pack(
+            fmt, calcsize(fmt), HostCode.clock_sync.value, id_val,
+            HostError.no_error.value
+        )
+
+    def sync_clock(
+            self, exchanges: int = 8, id_val: int = 0, timeout: float = 0.1
+    ) -> list[dict]:
+        """Runs ping-pong clock_sync exchanges with the device and adds them
+        to ``clock``. Returns the other messages read in the meantime.
+        """
+        if self.clock is None:
+            self.clock = ClockSync()
+
+        msgs = []
+        for _ in range(exchanges):
+            sent = time.monotonic()
+            self.write_serial(self.make_clock_sync(id_val))
+
+            reply = None
+            while reply is None and time.monotonic() - sent < timeout:
+                self.read_serial()
+                received = time.monotonic()
+                for msg in self.parse_buffer():
+                    if msg["src"] == HostCode.clock_sync and \
+                            msg["id_val"] == id_val and reply is None:
+                        reply = msg
+                    else:
+                        msgs.append(msg)
+
+            if reply is not None and reply["error"] == HostError.no_error:
+                self.clock.add_sample(sent, received, reply["device_us"])
+
+        return msgs
+
+    def make_scheduled(self, id_val: int, at_us: int, frame: bytes = b''):
+        """Wraps a complete ``frame`` made by any of the other ``make_``
+        methods, so the device handles it once its ``micros64()`` reaches
+        ``at_us``, see ``ClockSync.to_device``.
+
+        The device acks right away with just the header, and once it handled
+        the frame, after the frame's own response, it sends ``at_us`` and
+        ``done_us`` with this ``id_val``. Without ``frame``, all the frames
+        still waiting are dropped.
+        """
+        if len(frame) > self._scheduled_frame_n:
+            raise ValueError(
+                f"Only frames of up to {self._scheduled_frame_n} bytes can "
+                f"be scheduled")
+
+        fmt = '<' + self._host_comm_f + self._scheduled_f
+        return pack(
+            fmt, calcsize(fmt) + len(frame), HostCode.scheduled.value, id_val,
+            HostError.no_error.value, at_us
+        ) + frame
+
+    def make_journal_enable(self, id_val: int):
+        """From now on, the device keeps every frame it sends in its journal
+        and sends it inside a ``JournalCmd.event``. Those are parsed as the
+        frame, with the added ``seq`` and ``journal_us``. The sequence
+        numbers start at 0.
+        """
+        fmt = '<' + self._host_comm_f + self._journal_data_f
+        return pack(
+            fmt, calcsize(fmt), HostCode.journal.value, id_val,
+            HostError.no_error.value, JournalCmd.enable.value
+        )
+
+    def make_journal_disable(self, id_val: int):
+        fmt = '<' + self._host_comm_f + self._journal_data_f
+        return pack(
+            fmt, calcsize(fmt), HostCode.journal.value, id_val,
+            HostError.no_error.value, JournalCmd.disable.value
+        )
+
+    def make_journal_dump(self, id_val: int, from_seq: int, n: int):
+        """Asks for the ``n`` events from ``from_seq`` on to be sent again,
+        as space allows. Once they're sent, the device acks with the
+        ``from_seq`` and ``n`` it actually sent, which starts later if the
+        older events were already overwritten. A new dump replaces the one in
+        progress.
+        """
+        fmt = '<' + self._host_comm_f + self._journal_data_f + \
+            self._journal_dump_f
+        return pack(
+            fmt, calcsize(fmt), HostCode.journal.value, id_val,
+            HostError.no_error.value, JournalCmd.dump.value, from_seq, n
+        )
+
+    def make_telemetry_host(self, id_val: int):
+        """Asks for the counters of the serial link and the main loop times
+        since the previous host report, which resets them.
+        """
+        fmt = '<' + self._host_comm_f + self._telemetry_data_f
+        return pack(
+            fmt, calcsize(fmt), HostCode.telemetry.value, id_val,
+            HostError.no_error.value, TelemetryCmd.host.value
+        )
+
+    def make_telemetry_board(self, id_val: int, port: int, address: int):
+        """Asks for the transaction counters, queue depths and transaction
+        time histogram of the board since it was created. ``latency[i]``
+        counts the transactions that took under 128 us for 0, and from
+        ``64 << i`` us otherwise.
+        """
+        fmt = '<' + self._host_comm_f + self._telemetry_data_f + \
+            self._telemetry_board_f
+        return pack(
+            fmt, calcsize(fmt), HostCode.telemetry.value, id_val,
+            HostError.no_error.value, TelemetryCmd.board.value, port, address
+        )
+
+    def make_telemetry_push(self, id_val: int, period_us: int):
+        """Has the device send the host report and that of every board
+        every ``period_us``, with this ``id_val``, or stops with 0. The
+        period must be at least 10 ms.
+        """
+        fmt = '<' + self._host_comm_f + self._telemetry_data_f + \
+            self._telemetry_push_f
+        return pack(
+            fmt, calcsize(fmt), HostCode.telemetry.value, id_val,
+            HostError.no_error.value, TelemetryCmd.push.value, period_us
+        )
+
+    def make_telemetry_profile(self, id_val: int, point: ProfilePoint):
+        """Asks for the cycle histogram of one of the profiled scopes since
+        the last ``make_telemetry_profile_reset``. ``bins[i]`` counts the
+        calls that took under 64 cycles for 0, and from ``32 << i`` cycles
+        otherwise, the last bin counting anything longer. Firmware built
+        without ``PROFILE_ENABLED`` responds with ``HostError.not_running``.
+        """
+        fmt = '<' + self._host_comm_f + self._telemetry_data_f + \
+            self._telemetry_profile_f
+        return pack(
+            fmt, calcsize(fmt), HostCode.telemetry.value, id_val,
+            HostError.no_error.value, TelemetryCmd.profile.value, point
+        )
+
+    def make_telemetry_profile_reset(self, id_val: int):
+        fmt = '<' + self._host_comm_f + self._telemetry_data_f
+        return pack(
+            fmt, calcsize(fmt), HostCode.telemetry.value, id_val,
+            HostError.no_error.value, TelemetryCmd.profile_reset.value
+        )
+
+    def make_trigger_add(
+            self, id_val: int, rule: int, port: int, address: int,
+            rising_mask: int, falling_mask: int, frame: bytes,
+            flags: TriggerFlags = TriggerFlags.none
+    ):
+        """Replaces the rule at index ``rule`` with one that handles
+        ``frame`` on the device when an input of the board in ``rising_mask``
+        rises or one in ``falling_mask`` falls, as seen by its continuous or
+        edge reads.
+
+        ``frame`` is a ``make_modio_write_digital``,
+        ``make_modio_write_digital_masked``,
+        ``make_modio_write_digital_pulse`` or ``make_marker_mark`` frame, whose
+        response is sent as usual. Each firing is then reported with
+        ``TriggerCmd.fired``, this ``id_val`` and the edges. With
+        ``TriggerFlags.armed`` the rule only fires within the window of
+        ``make_trigger_arm``, and with ``TriggerFlags.once`` firing ends it.
+        """
+        if len(frame) > self._trigger_frame_n:
+            raise ValueError(
+                f"Only frames of up to {self._trigger_frame_n} bytes can be "
+                f"triggered")
+
+        fmt = '<' + self._host_comm_f + self._trigger_data_f + \
+            self._trigger_add_f
+        return pack(
+            fmt, calcsize(fmt) + len(frame), HostCode.trigger.value, id_val,
+            HostError.no_error.value, TriggerCmd.add.value, rule, port,
+            address, rising_mask, falling_mask, flags
+        ) + frame
+
+    def make_trigger_remove(self, id_val: int, rule: int):
+        fmt = '<' + self._host_comm_f + self._trigger_data_f
+        return pack(
+            fmt, calcsize(fmt), HostCode.trigger.value, id_val,
+            HostError.no_error.value, TriggerCmd.remove.value, rule
+        )
+
+    def make_trigger_clear(self, id_val: int):
+        fmt = '<' + self._host_comm_f + self._trigger_data_f
+        return pack(
+            fmt, calcsize(fmt), HostCode.trigger.value, id_val,
+            HostError.no_error.value, TriggerCmd.clear.value, 0
+        )
+
+    def make_trigger_arm(self, id_val: int, rule: int, window_us: int):
+        """Arms the rule for ``window_us`` from when the device handles
+        it, or disarms it with 0. It can be sent with ``make_scheduled``.
+        """
+        fmt = '<' + self._host_comm_f + self._trigger_data_f + \
+            self._trigger_arm_f
+        return pack(
+            fmt, calcsize(fmt), HostCode.trigger.value, id_val,
+            HostError.no_error.value, TriggerCmd.arm.value, rule, window_us
+        )
+
     def make_modio_create(
             self, id_val: int, port: int, address: int, freq: ModIOFreq,
-            pullup: ModIOPullup
+            pullup: ModIOPullup, flags: ModIOFlags = ModIOFlags.none,
+            timeout_us: int = 0, queue_n: int = 0, urgent_n: int = 0,
+            device: ModIODevice = ModIODevice.mod_io
     ):
+        """With ``ModIOFlags.timestamps``, the board's read and write
+        responses also carry the device ``micros()`` when the I2C transaction
+        was issued and when it completed, as ``issued_us`` and ``done_us``.
+
+        A transaction taking longer than ``timeout_us`` fails, and after
+        repeated failures the port is recovered. 0 uses the device default.
+        The board then sends ``ModIOCmd.health`` with this ``id_val``
+        whenever its health changes.
+
+        ``queue_n`` and ``urgent_n`` are the depths of the board's normal and
+        urgent request queues, 0 for the device defaults. All the boards
+        share one pool of queue entries, and the create fails with
+        ``HostError.no_resource`` once it has no room left for them.
+
+        ``device`` selects the driver of the board, the same requests work
+        for all of them.
+        """
         fmt = '<' + self._host_comm_f + self._modio_data_f + \
               self._modio_create_f
 
         return pack(
             fmt, calcsize(fmt), HostCode.modio_board.value, id_val,
             HostError.no_error.value, port, address, ModIOCmd.create.value,
-            freq.value, pullup.value
+            freq.value, pullup.value, flags, timeout_us, queue_n, urgent_n,
+            device.value
         )
 
     def make_modio_remove(self, id_val: int, port: int, address: int):
+        """Removes the board. Its queued requests, and a running continuous
+        read or pulse train, are first answered with
+        ``HostError.not_found``.
+        """
         fmt = '<' + self._host_comm_f + self._modio_data_f
 
         return pack(
@@ -138,14 +701,97 @@ class TeensyComm:
         )
 
     def make_modio_read_digital_cont_start(
-            self, id_val: int, port: int, address: int
+            self, id_val: int, port: int, address: int, interval_us: int = 0
+    ):
+        """Reads the board every ``interval_us``, or as often as the bus
+        allows if it's zero, and sends the value whenever it changes. The
+        interval replaces that of a running read once this one reaches the
+        front of the queue, and a queued one is replaced like for
+        ``make_modio_read_digital_edges_start``.
+
+        With the marker enabled, a value whose marker code didn't fit the
+        marker's queue is followed by a frame with the same id and
+        ``HostError.overflow``. The value is valid, but its code wasn't sent.
+        """
+        fmt = '<' + self._host_comm_f + self._modio_data_f + \
+              self._modio_cont_f
+
+        return pack(
+            fmt, calcsize(fmt), HostCode.modio_board.value, id_val,
+            HostError.no_error.value, port, address,
+            ModIOCmd.read_dig_cont_start.value, interval_us
+        )
+
+    def make_modio_read_digital_edges_start(
+            self, id_val: int, port: int, address: int, rising_mask: int = 0xF,
+            falling_mask: int = 0xF, debounce_ms: tuple[int] = (0, 0, 0, 0),
+            interval_us: int = 0
     ):
+        """Continuously reads the inputs but only sends their edges, once
+        each input held its new level for its ``debounce_ms``. Each response
+        has ``rose`` and ``fell`` bit masks and the device ``time_us`` the
+        inputs changed. The first one has no edges and gives the initial
+        ``value``. The board is read every ``interval_us`` like for
+        ``make_modio_read_digital_cont_start``. Stopped with
+        ``make_modio_read_digital_cont_stop``.
+
+        The masks, debounce and interval replace those of a running read
+        once this one reaches the front of the queue. A continuous read
+        that's still queued when another one arrives never starts and is
+        answered with ``HostError.coalesced``.
+        """
+        if len(debounce_ms) != self._modio_inputs_n:
+            raise ValueError(
+                f"Need a debounce time for each of the "
+                f"{self._modio_inputs_n} inputs")
+
+        fmt = '<' + self._host_comm_f + self._modio_data_f + \
+              self._modio_edges_f
+
+        return pack(
+            fmt, calcsize(fmt), HostCode.modio_board.value, id_val,
+            HostError.no_error.value, port, address,
+            ModIOCmd.read_dig_edges_start.value, rising_mask, falling_mask,
+            *debounce_ms, interval_us
+        )
+
+    def make_modio_poll_stats(self, id_val: int, port: int, address: int):
+        """The response has the ``interval_us`` and how long the continuous
+        read has been running as ``active_us``, with the number of ``polls``,
+        ``missed`` deadlines and the ``max_late_us`` a read was started
+        after its deadline.
+        """
         fmt = '<' + self._host_comm_f + self._modio_data_f
 
         return pack(
             fmt, calcsize(fmt), HostCode.modio_board.value, id_val,
             HostError.no_error.value, port, address,
-            ModIOCmd.read_dig_cont_start.value
+            ModIOCmd.poll_stats.value
+        )
+
+    def make_modio_queue_stats(self, id_val: int, port: int, address: int):
+        """The response has ``lanes``, indexed by ``ModIOLane``, each with the
+        number of ``requests`` started and their ``mean_us`` and ``max_us``
+        wait in the queue.
+        """
+        fmt = '<' + self._host_comm_f + self._modio_data_f
+
+        return pack(
+            fmt, calcsize(fmt), HostCode.modio_board.value, id_val,
+            HostError.no_error.value, port, address,
+            ModIOCmd.queue_stats.value
+        )
+
+    def make_modio_health(self, id_val: int, port: int, address: int):
+        """The response has the board's ``health`` as a ``ModIOHealth``, its
+        ``failures`` in a row, the ``recoveries`` of its port and its
+        ``timeout_us``.
+        """
+        fmt = '<' + self._host_comm_f + self._modio_data_f
+
+        return pack(
+            fmt, calcsize(fmt), HostCode.modio_board.value, id_val,
+            HostError.no_error.value, port, address, ModIOCmd.health.value
         )
 
     def make_modio_read_digital_cont_stop(
@@ -177,6 +823,49 @@ class TeensyComm:
             0, value
         )
 
+    def make_modio_write_digital_masked(
+            self, id_val: int, port: int, address: int, value: int, mask: int
+    ):
+        """Only writes the relays whose bit is set in ``mask``, the others
+        keep the last value written to the board.
+
+        For boards created with ``ModIOFlags.coalesce``, a write that didn't
+        start yet is replaced by a later one and answered right away with
+        ``HostError.coalesced``.
+        """
+        fmt = '<' + self._host_comm_f + self._modio_data_f + \
+              self._modio_data_buff_f + 'B'
+
+        return pack(
+            fmt, calcsize(fmt), HostCode.modio_board.value, id_val,
+            HostError.no_error.value, port, address, ModIOCmd.write_dig.value,
+            0, value, mask
+        )
+
+    def make_modio_write_digital_pulse(
+            self, id_val: int, port: int, address: int, relays: int,
+            on_us: int, off_us: int = 0, count: int = 1
+    ):
+        """Opens the relays whose bit is set in ``relays`` for ``on_us`` and
+        closes them for ``off_us``, ``count`` times, timed by the device.
+
+        The device acks twice, with ``pulses`` 0 once the first pulse opened
+        the relays and with ``pulses`` ``count`` once the last one closed
+        them. Both include the ``issued_us`` and ``done_us`` of that write.
+        While the train runs, ``write_dig`` leaves its relays alone, and a
+        second train for the board fails with ``HostError.bad_state``. Masked
+        writes merge with the relays as written by the host, with the
+        train's relays closed, never with an edge of the train.
+        """
+        fmt = '<' + self._host_comm_f + self._modio_data_f + \
+              self._modio_data_buff_f + self._modio_pulse_f
+
+        return pack(
+            fmt, calcsize(fmt), HostCode.modio_board.value, id_val,
+            HostError.no_error.value, port, address,
+            ModIOCmd.write_dig_pulse.value, 0, relays, on_us, off_us, count
+        )
+
     def make_modio_change_address(
             self, id_val: int, port: int, address: int, new_address: int
     ):
@@ -193,7 +882,7 @@ class TeensyComm:
             self, id_val: int, duration: int, clock_pin: int, data_pin: int
     ):
         fmt = '<' + self._host_comm_f + self._marker_data_f + \
-              self._modio_create_f
+              self._marker_enable_f
 
         return pack(
             fmt, calcsize(fmt), HostCode.stream_marker.value, id_val,
@@ -201,6 +890,24 @@ class TeensyComm:
             duration, clock_pin, data_pin
         )
 
+    def make_marker_enable_parallel(
+            self, id_val: int, duration: int, strobe_pin: int,
+            data_pins: list[int]
+    ):
+        """data_pins[i] carries bit i of the code."""
+        if len(data_pins) != self._marker_parallel_bits_n:
+            raise ValueError(
+                f"Need {self._marker_parallel_bits_n} data pins")
+
+        fmt = '<' + self._host_comm_f + self._marker_data_f + \
+              self._marker_enable_parallel_f
+
+        return pack(
+            fmt, calcsize(fmt), HostCode.stream_marker.value, id_val,
+            HostError.no_error.value, MarkerCmd.enable_parallel.value,
+            duration, strobe_pin, *data_pins
+        )
+
     def make_marker_disable(self, id_val: int):
         fmt = '<' + self._host_comm_f + self._marker_data_f
 
@@ -217,6 +924,14 @@ class TeensyComm:
             HostError.no_error.value, MarkerCmd.mark.value
         )
 
+    def make_marker_stats(self, id_val: int):
+        fmt = '<' + self._host_comm_f + self._marker_data_f
+
+        return pack(
+            fmt, calcsize(fmt), HostCode.stream_marker.value, id_val,
+            HostError.no_error.value, MarkerCmd.stats.value
+        )
+
     def parse_buffer(self) -> list[dict]:
         buffer = self._buffer
         if not buffer:
@@ -247,11 +962,17 @@ class TeensyComm:
         marker_data_n = calcsize(marker_data_f)
         marker_item_f = self._marker_item_f
         marker_item_n = calcsize(marker_item_f)
+        marker_stats_f = self._marker_stats_f
+        marker_stats_n = calcsize('<' + marker_stats_f)
 
         modio_data_f = self._modio_data_f
         modio_data_n = calcsize(modio_data_f)
         modio_data_buff_f = self._modio_data_buff_f
         modio_data_buff_n = calcsize(modio_data_buff_f)
+        modio_data_ts_f = self._modio_data_ts_f
+        modio_data_ts_n = calcsize('<' + modio_data_ts_f)
+        modio_edge_f = self._modio_edge_f
+        modio_edge_n = calcsize('<' + modio_edge_f)
 
         result = {}
 
@@ -267,7 +988,28 @@ class TeensyComm:
         error = result["error"] != HostError.no_error
 
         start = host_n
-        if code == HostCode.echo or code == HostCode.comm:
+        if code == HostCode.clock_sync and not error:
+            end = start + calcsize('<' + self._clock_sync_f)
+            if n != end:
+                raise ValueError("Read packet has wrong size for clock data")
+
+            result["device_us"], = unpack(
+                "<" + self._clock_sync_f, data[start:end])
+            return result
+
+        if code == HostCode.scheduled and n != start:
+            end = start + calcsize('<' + self._scheduled_done_f)
+            if n != end:
+                raise ValueError(
+                    "Read packet has wrong size for scheduled data")
+
+            result["at_us"], result["done_us"] = unpack(
+                "<" + self._scheduled_done_f, data[start:end])
+            return result
+
+        if code in (
+                HostCode.echo, HostCode.comm, HostCode.clock_sync,
+                HostCode.scheduled):
             if n != start:
                 raise ValueError("Read packet has too much data")
             return result
@@ -276,7 +1018,143 @@ class TeensyComm:
         if n == start and error:
             return result
 
-        if code == HostCode.stream_marker:
+        if code == HostCode.journal:
+            end = start + calcsize('<' + self._journal_data_f)
+            if n < end:
+                raise ValueError("Read packet is too small for journal data")
+
+            cmd, = unpack("<" + self._journal_data_f, data[start:end])
+            cmd = JournalCmd(cmd)
+            start = end
+
+            if cmd == JournalCmd.event:
+                end = start + calcsize('<' + self._journal_event_f)
+                if n <= end:
+                    raise ValueError(
+                        "Read packet is too small for journal data")
+
+                seq, journal_us = unpack(
+                    "<" + self._journal_event_f, data[start:end])
+                result = self._parse_message(data[end:])
+                result['seq'] = seq
+                result['journal_us'] = journal_us
+                return result
+
+            result['cmd'] = cmd
+            if cmd == JournalCmd.dump and not error:
+                end = start + calcsize('<' + self._journal_dump_f)
+                if n < end:
+                    raise ValueError(
+                        "Read packet is too small for journal data")
+
+                result['from_seq'], result['n'] = unpack(
+                    "<" + self._journal_dump_f, data[start:end])
+                start = end
+
+        elif code == HostCode.trigger:
+            end = start + calcsize('<' + self._trigger_data_f)
+            if n < end:
+                raise ValueError("Read packet is too small for trigger data")
+
+            cmd, result['rule'] = unpack(
+                "<" + self._trigger_data_f, data[start:end])
+            cmd = TriggerCmd(cmd)
+            result['cmd'] = cmd
+            start = end
+
+            if cmd == TriggerCmd.fired:
+                end = start + calcsize('<' + self._trigger_fired_f)
+                if n < end:
+                    raise ValueError(
+                        "Read packet is too small for trigger data")
+
+                result['rose'], result['fell'], result['time_us'] = unpack(
+                    "<" + self._trigger_fired_f, data[start:end])
+                start = end
+
+        elif code == HostCode.telemetry:
+            end = start + calcsize('<' + self._telemetry_data_f)
+            if n < end:
+                raise ValueError(
+                    "Read packet is too small for telemetry data")
+
+            cmd, = unpack("<" + self._telemetry_data_f, data[start:end])
+            cmd = TelemetryCmd(cmd)
+            result['cmd'] = cmd
+            start = end
+
+            if cmd == TelemetryCmd.host and not error:
+                end = start + calcsize('<' + self._telemetry_host_f)
+                if n < end:
+                    raise ValueError(
+                        "Read packet is too small for telemetry data")
+
+                (
+                    result['bytes_in'], result['bytes_out'],
+                    result['dropped_msgs'], result['dropped_bytes'],
+                    result['bad_bytes'], result['tx_max_held'],
+                    result['loops'], result['loop_mean_ns'],
+                    result['loop_min_us'], result['loop_max_us']
+                ) = unpack("<" + self._telemetry_host_f, data[start:end])
+                start = end
+
+            elif cmd == TelemetryCmd.board and not error:
+                fmt = "<" + self._telemetry_board_f + \
+                    self._telemetry_board_stats_f
+                end = start + calcsize(fmt)
+                if n < end:
+                    raise ValueError(
+                        "Read packet is too small for telemetry data")
+
+                (
+                    result['port'], result['address'],
+                    result['transactions'], result['errors'],
+                    result['timeouts']
+                ) = unpack(fmt, data[start:end])
+                start = end
+
+                queue_n = calcsize('<' + self._telemetry_queue_f)
+                result['lanes'] = []
+                for _ in ModIOLane:
+                    end = start + queue_n
+                    if n < end:
+                        raise ValueError(
+                            "Read packet is too small for telemetry data")
+
+                    max_n, mean_x100 = unpack(
+                        "<" + self._telemetry_queue_f, data[start:end])
+                    result['lanes'].append(
+                        {'max': max_n, 'mean': mean_x100 / 100})
+                    start = end
+
+                fmt = f"<{self._telemetry_latency_bins_n}L"
+                end = start + calcsize(fmt)
+                if n < end:
+                    raise ValueError(
+                        "Read packet is too small for telemetry data")
+
+                result['latency'] = list(unpack(fmt, data[start:end]))
+                start = end
+
+            elif cmd == TelemetryCmd.profile and not error:
+                fmt = "<" + self._telemetry_profile_f + \
+                    self._telemetry_profile_stats_f + \
+                    f"{self._profile_bins_n}L"
+                end = start + calcsize(fmt)
+                if n < end:
+                    raise ValueError(
+                        "Read packet is too small for telemetry data")
+
+                vals = unpack(fmt, data[start:end])
+                result['point'] = ProfilePoint(vals[0])
+                (
+                    result['cycles_per_us'], result['count'],
+                    result['max_cycles'], result['total_cycles']
+                ) = vals[1:5]
+                result['bins'] = list(vals[5:])
+                start = end
+
+        elif code == HostCode.stream_marker:
             end = start + marker_data_n
             if n < end:
                 raise ValueError("Read packet is too small for marker data")
@@ -286,8 +1164,8 @@ class TeensyComm:
             result['cmd'] = cmd
             start = end
 
-            # only mark sends back additional data
-            if code == MarkerCmd.mark:
+            # only mark and stats send back additional data
+            if cmd == MarkerCmd.mark:
                 if n == start and error:
                     return result
 
@@ -298,6 +1176,20 @@ class TeensyComm:
                 result["marker"], = unpack("<" + marker_item_f, data[start:end])
                 start = end
 
+            elif cmd == MarkerCmd.stats:
+                if n == start and error:
+                    return result
+
+                end = start + marker_stats_n
+                if n < end:
+                    raise ValueError("Read packet is too small for marker data")
+
+                (
+                    result["max_jitter"], result["codes_sent"],
+                    result["overflows"], result["queue_max"]
+                ) = unpack("<" + marker_stats_f, data[start:end])
+                start = end
+
         elif code == HostCode.modio_board:
             end = start + modio_data_n
             if n < end:
@@ -310,10 +1202,50 @@ class TeensyComm:
             result['address'] = address
             start = end
 
+            if cmd == ModIOCmd.poll_stats and not error:
+                end = start + calcsize('<' + self._modio_poll_stats_f)
+                if n < end:
+                    raise ValueError("Read packet is too small for modio data")
+
+                (
+                    result['interval_us'], result['active_us'],
+                    result['polls'], result['missed'], result['max_late_us']
+                ) = unpack("<" + self._modio_poll_stats_f, data[start:end])
+                start = end
+
+            elif cmd == ModIOCmd.queue_stats and not error:
+                wait_n = calcsize('<' + self._modio_wait_stats_f)
+                result['lanes'] = []
+                for _ in ModIOLane:
+                    end = start + wait_n
+                    if n < end:
+                        raise ValueError(
+                            "Read packet is too small for modio data")
+
+                    requests, mean_us, max_us = unpack(
+                        "<" + self._modio_wait_stats_f, data[start:end])
+                    result['lanes'].append({
+                        'requests': requests, 'mean_us': mean_us,
+                        'max_us': max_us})
+                    start = end
+
+            elif cmd == ModIOCmd.health and not error:
+                end = start + calcsize('<' + self._modio_health_f)
+                if n < end:
+                    raise ValueError("Read packet is too small for modio data")
+
+                (
+                    health, result['failures'], result['recoveries'],
+                    result['timeout_us']
+                ) = unpack("<" + self._modio_health_f, data[start:end])
+                result['health'] = ModIOHealth(health)
+                start = end
+
             # only mark sends back additional data
-            if cmd in (
+            elif cmd in (
                     ModIOCmd.write_dig, ModIOCmd.read_dig,
-                    ModIOCmd.read_dig_cont_start, ModIOCmd.address_change
+                    ModIOCmd.read_dig_cont_start, ModIOCmd.address_change,
+                    ModIOCmd.read_dig_edges_start, ModIOCmd.write_dig_pulse
             ):
                 if n == start and error:
                     return result
@@ -323,9 +1255,36 @@ class TeensyComm:
                     raise ValueError("Read packet is too small for modio data")
 
                 result['mark'], result['value'], = unpack(
-                    "<" + marker_item_f, data[start:end])
+                    "<" + modio_data_buff_f, data[start:end])
                 start = end
 
+                if cmd == ModIOCmd.read_dig_edges_start:
+                    end = start + modio_edge_n
+                    if n < end:
+                        raise ValueError(
+                            "Read packet is too small for modio edge data")
+
+                    result['rose'], result['fell'], result['time_us'] = \
+                        unpack("<" + modio_edge_f, data[start:end])
+                    start = end
+
+                elif cmd == ModIOCmd.write_dig_pulse:
+                    fmt = "<" + modio_data_ts_f + self._modio_pulse_ts_f
+                    end = start + calcsize(fmt)
+                    if n < end:
+                        raise ValueError(
+                            "Read packet is too small for modio pulse data")
+
+                    result['issued_us'], result['done_us'], \
+                        result['pulses'] = unpack(fmt, data[start:end])
+                    start = end
+
+                elif n == start + modio_data_ts_n:
+                    end = start + modio_data_ts_n
+                    result['issued_us'], result['done_us'] = unpack(
+                        "<" + modio_data_ts_f, data[start:end])
+                    start = end
+
         if n != start:
             raise ValueError("Read packet has too much data")
 
@@ -2,13 +2,41 @@
 #include "host_comm.h"
 #include "i2c_board.h"
 #include "marker.h"
+#include "profile.h"
+#include "telemetry.h"
+#include "triggers.h"
+#include "utils.h"
 
 // based on https://github.com/PaulStoffregen/cores/blob/5b6d81b05a5df51bb8b2734c2f5b4f55ba4f2af2/teensy4/usb_serial.h
 
 
 HostComm::HostComm()
 {
+  uint8_t i = 0;
+
   _read_buff_n = 0;
+  _last_read_time = 0;
+  _read_bad_bytes = 0;
+  _bytes_in = 0;
+  _resyncing = false;
+
+  _tx_start = 0;
+  _tx_n = 0;
+  _tx_max_n = 0;
+  _tx_dropped_bytes = 0;
+  _tx_dropped_msgs = 0;
+  _bytes_out = 0;
+
+  for (; i < HOST_SCHEDULE_N; i++)
+    _sched_order[i] = i;
+  _sched_n = 0;
+
+  _journal_enabled = false;
+  _journal_start = 0;
+  _journal_n = 0;
+  _journal_first_seq = 0;
+  _journal_next_seq = 0;
+  _dumping = false;
 }
 
 
@@ -22,11 +50,47 @@ void HostComm::setup(StreamMarker* marker)
   _last_led_time = millis();
 }
 
+static inline uint8_t larger(size_t a, size_t b)
+{
+  return a > b ? a : b;
+}
+
+// largest frame the host can send for each code, anything bigger means we lost sync
+static uint8_t max_frame_len(HostCode code)
+{
+  switch (code)
+  {
+    case HostCode::modio_board:
+      return larger(larger(larger(sizeof(ModIODataCreate), sizeof(ModIODataBuff)), sizeof(ModIODataEdges)), sizeof(ModIODataPulse));
+    case HostCode::stream_marker:
+      return larger(sizeof(MarkerDataEnable), sizeof(MarkerDataEnableParallel));
+    case HostCode::echo:
+    case HostCode::clock_sync:
+      return sizeof(HostData);
+    case HostCode::scheduled:
+      return sizeof(HostDataScheduled) + HOST_SCHEDULED_FRAME_N;
+    case HostCode::trigger:
+      return larger(sizeof(TriggerDataAdd) + TRIGGER_FRAME_N, sizeof(TriggerDataArm));
+    case HostCode::journal:
+      return sizeof(HostDataJournalDump);
+    case HostCode::telemetry:
+      return larger(sizeof(TelemetryDataBoard), sizeof(TelemetryDataPush));
+    default:
+      return 0;
+  }
+}
+
 void HostComm::loop()
 {
-  HostData header;
+  PROFILE_SCOPE(ProfilePoint::host_comm_loop);
   int n = Serial.available();
-  int item;
+  uint16_t i = 0;
+  uint16_t have;
+  uint8_t len;
+  bool bad;
+
+  run_scheduled();
+  send_dump();
 
   if (n <= 0)
   {
@@ -38,6 +102,10 @@ void HostComm::loop()
       _led_high = !_led_high;
       _last_led_time = millis();
     }
+
+    // a partial frame that never completes had a bad length, drop it
+    if (_read_buff_n && millis() - _last_read_time >= HOST_RX_TIMEOUT_MS)
+      discard_read(_read_buff_n);
     return;
   }
 
@@ -45,80 +113,488 @@ void HostComm::loop()
   digitalWrite(LED_BUILTIN, _led_high ? LOW : HIGH);
   _led_high = !_led_high;
   _last_led_time = millis();
+  _last_read_time = _last_led_time;
+
+  // read everything that fits in one go
+  if (n > HOST_RX_BUFF_N - _read_buff_n)
+    n = HOST_RX_BUFF_N - _read_buff_n;
+  n = Serial.readBytes((char*)&_read_buff[_read_buff_n], n);
+  _read_buff_n += n;
+  _bytes_in += n;
+
+  // handle all complete frames in place
+  while (i < _read_buff_n)
+  {
+    have = _read_buff_n - i;
+    len = have > 1 ? _read_buff[i + 1] : 0;
+
+    // check the frame as soon as we have each part of it, and skip a byte at a time until it's valid. A frame
+    // whose length was corrupted to another valid one fails the CRC
+    bad = _read_buff[i] != HOST_SYNC
+      || (have > 1 && len < sizeof(HostData))
+      || (have > 2 && len > max_frame_len(((HostData*)&_read_buff[i + 1])->code))
+      || (
+          have >= len + 2u
+          && (((HostData*)&_read_buff[i + 1])->err != HostError::no_error
+              || crc8(&_read_buff[i + 1], len) != _read_buff[i + 1 + len])
+         );
+    if (bad)
+    {
+      if (!_resyncing)
+      {
+        send_error(HostError::bad_input);
+        _resyncing = true;
+      }
+      _read_bad_bytes++;
+      i++;
+      continue;
+    }
+
+    if (have < len + 2u)
+      break;
+
+    _resyncing = false;
+    dispatch(&_read_buff[i + 1], len);
+    i += len + 2;
+  }
+
+  discard_read(i);
+}
+
+void HostComm::discard_read(uint16_t n)
+{
+  if (!n)
+    return;
+
+  // only a partial frame is left, if any
+  _read_buff_n -= n;
+  if (_read_buff_n)
+    memmove(_read_buff, &_read_buff[n], _read_buff_n);
+}
+
+void HostComm::send_error(HostError err)
+{
+  HostData header;
 
   header.len = sizeof(HostData);
   header.code = HostCode::comm;
   header.id = 0;
-  header.err = HostError::bad_input;
+  header.err = err;
+  send_to_host(&header, header.len);
+}
 
-  while (n)
-  {
-    // read single char
-    item = Serial.read();
-    if (item == -1)
-      return;
+void HostComm::send_clock(uint8_t* data)
+{
+  HostDataClock msg;
 
-    _read_buff[_read_buff_n++] = (uint8_t)item;
-    n--;
+  msg.header = *(HostData*)data;
+  msg.header.len = sizeof(HostDataClock);
+  msg.device_us = micros64();
+  send_to_host(&msg, sizeof(HostDataClock));
+}
 
-    // check if we have full message
-    if (_read_buff[0] != _read_buff_n)
-      continue;
+void HostComm::schedule(uint8_t* data, uint8_t len)
+{
+  HostDataScheduled* msg = (HostDataScheduled*)data;
+  HostData* frame = (HostData*)&data[sizeof(HostDataScheduled)];
+  uint8_t frame_len = len - sizeof(HostDataScheduled);
+  HostScheduledFrame* item;
+  uint8_t i;
+  uint8_t slot;
+
+  msg->header.err = HostError::no_error;
+  if (!frame_len)
+    _sched_n = 0;
+  else if (
+      frame_len < sizeof(HostData) || frame_len > HOST_SCHEDULED_FRAME_N || frame->len != frame_len
+      || frame->code == HostCode::scheduled || frame_len > max_frame_len(frame->code)
+      || frame->err != HostError::no_error
+     )
+    msg->header.err = HostError::bad_input;
+  else if (_sched_n == HOST_SCHEDULE_N)
+    msg->header.err = HostError::no_resource;
+  else
+  {
+    item = &_sched[_sched_order[_sched_n]];
+    item->at_us = msg->at_us;
+    item->id = msg->header.id;
+    memcpy(item->frame, frame, frame_len);
 
-    if (_read_buff_n < sizeof(HostData))
+    // after those due at the same time, so they run in the order they were sent
+    for (i = _sched_n; i && _sched[_sched_order[i - 1]].at_us > msg->at_us; i--)
     {
-      send_to_host(&header, header.len);
-      _read_buff_n = 0;
-      continue;
+      slot = _sched_order[i];
+      _sched_order[i] = _sched_order[i - 1];
+      _sched_order[i - 1] = slot;
     }
+    _sched_n++;
+  }
 
-    switch (((HostData*)_read_buff)->code)
-    {
-      case HostCode::modio_board:
-        if (_read_buff_n < sizeof(ModIOData))
-          send_to_host(&header, header.len);
-        else
-          ModIOBoard::host_msg((ModIOData*)_read_buff, this, _marker);
-        break;
+  msg->header.len = sizeof(HostData);
+  send_to_host(msg, sizeof(HostData));
+}
+
+void HostComm::run_scheduled()
+{
+  HostScheduledFrame* item;
+  HostDataScheduledDone done;
+  uint8_t frame[HOST_SCHEDULED_FRAME_N];
+  uint8_t slot;
+
+  while (_sched_n && micros64() >= _sched[_sched_order[0]].at_us)
+  {
+    slot = _sched_order[0];
+    item = &_sched[slot];
+    memcpy(frame, item->frame, item->frame[0]);
+    done.header.len = sizeof(HostDataScheduledDone);
+    done.header.code = HostCode::scheduled;
+    done.header.id = item->id;
+    done.header.err = HostError::no_error;
+    done.at_us = item->at_us;
+
+    // the slot is freed first, the handler may be anything
+    memmove(_sched_order, &_sched_order[1], --_sched_n);
+    _sched_order[_sched_n] = slot;
+
+    done.done_us = micros64();
+    dispatch(frame, frame[0]);
+    send_to_host(&done, sizeof(HostDataScheduledDone));
+  }
+}
+
+void HostComm::dispatch(uint8_t* data, uint8_t len)
+{
+  switch (((HostData*)data)->code)
+  {
+    case HostCode::modio_board:
+      if (len < sizeof(ModIOData))
+        send_error(HostError::bad_input);
+      else
+        ModIOBoard::host_msg((ModIOData*)data, this, _marker);
+      break;
+
+    case HostCode::stream_marker:
+      if (len < sizeof(MarkerData))
+        send_error(HostError::bad_input);
+      else
+        _marker->host_msg((MarkerData*)data);
+      break;
+
+    case HostCode::echo:
+      if (len != sizeof(HostData))
+        send_error(HostError::bad_input);
+      else
+        send_to_host(data, len);
+      break;
+
+    case HostCode::clock_sync:
+      if (len != sizeof(HostData))
+        send_error(HostError::bad_input);
+      else
+        send_clock(data);
+      break;
+
+    case HostCode::scheduled:
+      if (len < sizeof(HostDataScheduled))
+        send_error(HostError::bad_input);
+      else
+        schedule(data, len);
+      break;
+
+    case HostCode::trigger:
+      if (len < sizeof(TriggerData))
+        send_error(HostError::bad_input);
+      else
+        Triggers::host_msg((TriggerData*)data, len, this);
+      break;
+
+    case HostCode::journal:
+      if (len < sizeof(HostDataJournal))
+        send_error(HostError::bad_input);
+      else
+        journal_msg((HostDataJournal*)data, len);
+      break;
+
+    case HostCode::telemetry:
+      if (len < sizeof(TelemetryData))
+        send_error(HostError::bad_input);
+      else
+        Telemetry::host_msg((TelemetryData*)data, len, this);
+      break;
+
+    default:
+      send_error(HostError::bad_input);
+      break;
+  }
+}
+
+void HostComm::journal_msg(HostDataJournal* msg, uint8_t len)
+{
+  HostDataJournalDump* dump = (HostDataJournalDump*)msg;
 
-      case HostCode::stream_marker:
-        if (_read_buff_n < sizeof(MarkerData))
-          send_to_host(&header, header.len);
-        else
-          _marker->host_msg((MarkerData*)_read_buff);
+  msg->header.err = HostError::no_error;
+  switch (msg->cmd)
+  {
+    case JournalCmd::enable:
+      if (len != sizeof(HostDataJournal))
+      {
+        msg->header.err = HostError::bad_input;
         break;
+      }
+
+      // sequence numbers start over with an empty journal
+      _journal_enabled = true;
+      _journal_start = 0;
+      _journal_n = 0;
+      _journal_first_seq = 0;
+      _journal_next_seq = 0;
+      _dumping = false;
+      break;
 
-      case HostCode::echo:
-        if (_read_buff_n != sizeof(HostData))
-          send_to_host(&header, header.len);
-        else
-          send_to_host(_read_buff, _read_buff_n);
+    case JournalCmd::disable:
+      if (len != sizeof(HostDataJournal))
+      {
+        msg->header.err = HostError::bad_input;
         break;
+      }
 
-      default:
-        send_to_host(&header, header.len);
+      _journal_enabled = false;
+      _dumping = false;
+      break;
+
+    case JournalCmd::dump:
+      if (len != sizeof(HostDataJournalDump))
+      {
+        msg->header.err = HostError::bad_input;
+        break;
+      }
+      if (!_journal_enabled)
+      {
+        msg->header.err = HostError::not_running;
         break;
+      }
+
+      // a new dump replaces the one in progress, and is acked once it's sent
+      _dumping = true;
+      _dump_id = msg->header.id;
+      _dump_seq = _journal_first_seq;
+      _dump_at = _journal_start;
+      _dump_end = dump->from_seq + dump->n;
+      if (_dump_end < dump->from_seq || _dump_end > _journal_next_seq)
+        _dump_end = _journal_next_seq;
+      // walk to the first record asked for, if it's still there
+      while (_dump_seq < dump->from_seq && _dump_seq < _dump_end)
+      {
+        _dump_at = (_dump_at + sizeof(uint32_t) + _journal[(_dump_at + sizeof(uint32_t)) % HOST_JOURNAL_N]) % HOST_JOURNAL_N;
+        _dump_seq++;
+      }
+      _dump_from = _dump_seq;
+      return;
+
+    default:
+      msg->header.err = HostError::bad_input;
+      break;
+  }
+
+  msg->header.len = sizeof(HostDataJournal);
+  send_to_host(msg, sizeof(HostDataJournal));
+}
+
+uint32_t HostComm::journal_add(const void* data, uint8_t len, uint32_t time_us)
+{
+  uint32_t end;
+  uint32_t n = sizeof(uint32_t) + len;
+  uint32_t k;
+
+  // the oldest records make room
+  while (HOST_JOURNAL_N - _journal_n < n)
+  {
+    k = sizeof(uint32_t) + _journal[(_journal_start + sizeof(uint32_t)) % HOST_JOURNAL_N];
+    _journal_start = (_journal_start + k) % HOST_JOURNAL_N;
+    _journal_n -= k;
+    _journal_first_seq++;
+  }
+
+  end = (_journal_start + _journal_n) % HOST_JOURNAL_N;
+  for (k = 0; k < sizeof(uint32_t); k++)
+    _journal[(end + k) % HOST_JOURNAL_N] = ((uint8_t*)&time_us)[k];
+  end = (end + sizeof(uint32_t)) % HOST_JOURNAL_N;
+
+  k = HOST_JOURNAL_N - end;
+  if (k >= len)
+    memcpy(&_journal[end], data, len);
+  else
+  {
+    // wraps around the end of the ring
+    memcpy(&_journal[end], data, k);
+    memcpy(_journal, (const uint8_t*)data + k, len - k);
+  }
+
+  _journal_n += n;
+  return _journal_next_seq++;
+}
+
+void HostComm::journal_copy(uint32_t at, void* data, uint16_t len)
+{
+  uint32_t k = HOST_JOURNAL_N - at;
+
+  if (k >= len)
+    memcpy(data, &_journal[at], len);
+  else
+  {
+    memcpy(data, &_journal[at], k);
+    memcpy((uint8_t*)data + k, _journal, len - k);
+  }
+}
+
+void HostComm::send_dump()
+{
+  uint8_t buff[sizeof(HostDataJournalEvent) + UINT8_MAX];
+  HostDataJournalEvent* event = (HostDataJournalEvent*)buff;
+  HostDataJournalDump done;
+  uint8_t len;
+  uint16_t n;
+
+  while (_dumping)
+  {
+    // records overwritten while we were sending are skipped
+    if (_dump_seq < _journal_first_seq)
+    {
+      _dump_seq = _journal_first_seq;
+      _dump_at = _journal_start;
     }
 
-    _read_buff_n = 0;
+    if (_dump_seq >= _dump_end)
+    {
+      done.header.header.len = sizeof(HostDataJournalDump);
+      done.header.header.code = HostCode::journal;
+      done.header.header.id = _dump_id;
+      done.header.header.err = HostError::no_error;
+      done.header.cmd = JournalCmd::dump;
+      done.from_seq = _dump_from;
+      done.n = _dump_end > _dump_from ? _dump_end - _dump_from : 0;
+      _dumping = false;
+      send_to_host(&done, sizeof(HostDataJournalDump));
+      return;
+    }
+
+    // unlike live frames, the dump waits for room rather than being dropped
+    len = _journal[(_dump_at + sizeof(uint32_t)) % HOST_JOURNAL_N];
+    n = sizeof(HostDataJournalEvent) + len;
+    if (HOST_TX_BUFF_N - _tx_n < n)
+    {
+      flush_to_host();
+      if (HOST_TX_BUFF_N - _tx_n < n)
+        return;
+    }
+
+    event->header.header.len = n;
+    event->header.header.code = HostCode::journal;
+    event->header.header.id = 0;
+    event->header.header.err = HostError::no_error;
+    event->header.cmd = JournalCmd::event;
+    event->seq = _dump_seq;
+    journal_copy(_dump_at, &event->time_us, sizeof(uint32_t));
+    journal_copy((_dump_at + sizeof(uint32_t)) % HOST_JOURNAL_N, &buff[sizeof(HostDataJournalEvent)], len);
+    queue_tx(buff, event->header.header.len);
+
+    _dump_at = (_dump_at + sizeof(uint32_t) + len) % HOST_JOURNAL_N;
+    _dump_seq++;
   }
 }
 
 void HostComm::send_to_host(void* data, uint8_t len)
 {
+  PROFILE_SCOPE(ProfilePoint::send_to_host);
   HostData header;
+  uint8_t buff[UINT8_MAX];
+  HostDataJournalEvent* event = (HostDataJournalEvent*)buff;
+
+  // a drop notice names the frame itself, not the journal event wrapping it
+  header.len = sizeof(HostData);
+  header.code = ((HostData*)data)->code;
+  header.id = ((HostData*)data)->id;
+  header.err = HostError::dropping_data;
+
+  // the journal's own frames aren't journaled
+  if (_journal_enabled && ((HostData*)data)->code != HostCode::journal && len <= UINT8_MAX - sizeof(HostDataJournalEvent))
+  {
+    event->header.header.len = sizeof(HostDataJournalEvent) + len;
+    event->header.header.code = HostCode::journal;
+    event->header.header.id = 0;
+    event->header.header.err = HostError::no_error;
+    event->header.cmd = JournalCmd::event;
+    event->time_us = micros();
+    event->seq = journal_add(data, len, event->time_us);
+    memcpy(&buff[sizeof(HostDataJournalEvent)], data, len);
+
+    data = buff;
+    len = event->header.header.len;
+  }
+
+  if (HOST_TX_BUFF_N - _tx_n < len)
+    flush_to_host();
+
+  if (!queue_tx(data, len))
+  {
+    // if not enough space, drop msg and tell the host if there's room for that
+    _tx_dropped_bytes += len;
+    _tx_dropped_msgs++;
+    queue_tx(&header, sizeof(HostData));
+  }
+
+  if (_tx_n >= HOST_TX_FLUSH_N)
+    flush_to_host();
+}
+
+bool HostComm::queue_tx(const void* data, uint8_t len)
+{
+  uint16_t end = (_tx_start + _tx_n) % HOST_TX_BUFF_N;
+  uint16_t n = HOST_TX_BUFF_N - end;
 
-  if (Serial.availableForWrite() < len)
+  if (HOST_TX_BUFF_N - _tx_n < len)
+    return false;
+
+  if (n >= len)
+    memcpy(&_tx_buff[end], data, len);
+  else
   {
-    // if not enough space, block the write and drop msg
-    header.len = sizeof(HostData);
-    header.code = ((HostData*)data)->code;
-    header.id = ((HostData*)data)->id;
-    header.err = HostError::dropping_data;
-
-    len = sizeof(HostData);
-    data = &header;
+    // wraps around the end of the ring
+    memcpy(&_tx_buff[end], data, n);
+    memcpy(_tx_buff, (const uint8_t*)data + n, len - n);
   }
 
-  Serial.write((uint8_t*)data, len);
+  _tx_n += len;
+  if (_tx_n > _tx_max_n)
+    _tx_max_n = _tx_n;
+  return true;
+}
+
+void HostComm::flush_to_host()
+{
+  PROFILE_SCOPE(ProfilePoint::flush_to_host);
+  int space;
+  uint16_t n;
+
+  while (_tx_n)
+  {
+    space = Serial.availableForWrite();
+    if (space <= 0)
+      return;
+
+    // write the contiguous part, the rest on the next pass
+    n = HOST_TX_BUFF_N - _tx_start;
+    if (n > _tx_n)
+      n = _tx_n;
+    if (n > space)
+      n = space;
+
+    n = Serial.write(&_tx_buff[_tx_start], n);
+    if (!n)
+      return;
+
+    _bytes_out += n;
+    _tx_start = (_tx_start + n) % HOST_TX_BUFF_N;
+    _tx_n -= n;
+  }
 }
@@ -4,6 +4,30 @@
 class StreamMarker;
 
 
+// messages are packed into a ring buffer and written to USB in large writes once per loop
+#define HOST_TX_BUFF_N 4096
+// write right away once this much is waiting
+#define HOST_TX_FLUSH_N 1024
+// incoming bytes are read in bulk and complete frames are handled in place
+#define HOST_RX_BUFF_N 1024
+// a partial frame is dropped if it doesn't complete within this time
+#define HOST_RX_TIMEOUT_MS 100
+// the host sends every frame as HOST_SYNC, the frame and the crc8() of the frame. Anything that fails the checks
+// is skipped a byte at a time up to the next HOST_SYNC. Frames to the host are sent as they are
+#define HOST_SYNC 0xA5
+// frames sent ahead with HostCode::scheduled wait in a table until their time, each up to
+// HOST_SCHEDULED_FRAME_N long
+#ifndef HOST_SCHEDULE_N
+#define HOST_SCHEDULE_N 32
+#endif
+#define HOST_SCHEDULED_FRAME_N 32
+// with the journal enabled, every frame sent is also kept here with its sequence number, until newer ones
+// overwrite it
+#ifndef HOST_JOURNAL_N
+#define HOST_JOURNAL_N 16384
+#endif
+
+
 enum class HostError : uint8_t {
   no_error = 0,
   already_exists,
@@ -16,6 +40,8 @@ enum class HostError : uint8_t {
   program_error,
   dropping_data,
   timed_out,
+  overflow,
+  coalesced,
   end,
 };
 
@@ -25,6 +51,20 @@ enum class HostCode : uint8_t {
   stream_marker,
   comm,
   echo,
+  clock_sync,
+  scheduled,
+  trigger,
+  journal,
+  telemetry,
+  end,
+};
+
+
+enum class JournalCmd : uint8_t {
+  enable = 0,
+  disable,
+  dump,
+  event, // only sent by the device, wrapping a frame
   end,
 };
 
@@ -38,6 +78,65 @@ struct HostData
 };
 
 
+// response to a clock_sync request, which is just the HostData header
+struct __attribute__((packed)) HostDataClock
+{
+  HostData header;
+  // micros64() when the request was handled
+  uint64_t device_us;
+};
+
+
+// wraps a complete frame of another code, that's handled once micros64() reaches at_us. It's acked right away
+// with just the header. Without a frame, all the frames still waiting are dropped instead
+struct __attribute__((packed)) HostDataScheduled
+{
+  HostData header;
+  uint64_t at_us;
+};
+
+// sent with the id of the scheduled frame after it was handled, done_us being when that started
+struct __attribute__((packed)) HostDataScheduledDone
+{
+  HostData header;
+  uint64_t at_us;
+  uint64_t done_us;
+};
+
+// in case of error, we may respond with just this struct,
+// even if incoming struct had more data appeneded
+struct HostDataJournal
+{
+  HostData header;
+  JournalCmd cmd;
+};
+
+// dump asks for n events starting at from_seq to be sent again. It's acked after the last one with the range
+// that was sent, which starts later if the older events were overwritten
+struct __attribute__((packed)) HostDataJournalDump
+{
+  HostDataJournal header;
+  uint32_t from_seq;
+  uint32_t n;
+};
+
+// while the journal is enabled, every other frame is sent inside one of these, followed by the frame
+struct __attribute__((packed)) HostDataJournalEvent
+{
+  HostDataJournal header;
+  uint32_t seq;
+  // micros() when the frame was sent
+  uint32_t time_us;
+};
+
+struct HostScheduledFrame
+{
+  uint64_t at_us;
+  uint8_t id;
+  uint8_t frame[HOST_SCHEDULED_FRAME_N];
+};
+
+
 class HostComm
 {
   public:
@@ -46,15 +145,71 @@ class HostComm
     void loop();
 
     void send_to_host(void* data, uint8_t len);
+    void flush_to_host();
+    // handles a complete frame as if the host had just sent it
+    void dispatch(uint8_t* data, uint8_t len);
+
+    uint16_t tx_held() { return _tx_n; };
+    uint16_t tx_max_held() { return _tx_max_n; };
+    uint32_t tx_dropped_bytes() { return _tx_dropped_bytes; };
+    uint32_t tx_dropped_msgs() { return _tx_dropped_msgs; };
+    uint32_t read_bad_bytes() { return _read_bad_bytes; };
+    uint32_t bytes_in() { return _bytes_in; };
+    uint32_t bytes_out() { return _bytes_out; };
   
   private:
+    bool queue_tx(const void* data, uint8_t len);
+    void discard_read(uint16_t n);
+    void send_error(HostError err);
+    void send_clock(uint8_t* data);
+    void schedule(uint8_t* data, uint8_t len);
+    void run_scheduled();
+    void journal_msg(HostDataJournal* msg, uint8_t len);
+    uint32_t journal_add(const void* data, uint8_t len, uint32_t time_us);
+    void journal_copy(uint32_t at, void* data, uint16_t len);
+    void send_dump();
+
     uint _last_led_time;
     bool _led_high;
 
     StreamMarker* _marker;
 
-    uint8_t _read_buff[256];
-    uint8_t _read_buff_n;
+    // received bytes, each frame still wrapped in HOST_SYNC and its CRC
+    uint8_t _read_buff[HOST_RX_BUFF_N];
+    uint16_t _read_buff_n;
+    uint _last_read_time;
+    uint32_t _read_bad_bytes;
+    uint32_t _bytes_in;
+    bool _resyncing;
+
+    uint8_t _tx_buff[HOST_TX_BUFF_N];
+    uint16_t _tx_start;
+    uint16_t _tx_n;
+    uint16_t _tx_max_n;
+    uint32_t _tx_dropped_bytes;
+    uint32_t _tx_dropped_msgs;
+    uint32_t _bytes_out;
+
+    HostScheduledFrame _sched[HOST_SCHEDULE_N];
+    // all the slots, the first _sched_n are in use and sorted by at_us
+    uint8_t _sched_order[HOST_SCHEDULE_N];
+    uint8_t _sched_n;
+
+    // ring of records of micros() followed by the frame, the oldest at _journal_start with _journal_first_seq
+    bool _journal_enabled;
+    uint8_t _journal[HOST_JOURNAL_N];
+    uint32_t _journal_start;
+    uint32_t _journal_n;
+    uint32_t _journal_first_seq;
+    uint32_t _journal_next_seq;
+
+    // the dump in progress is sent as space in the TX buffer allows, from the record at _dump_at
+    bool _dumping;
+    uint8_t _dump_id;
+    uint32_t _dump_seq;
+    uint32_t _dump_end;
+    uint32_t _dump_at;
+    uint32_t _dump_from;
 
 };
 
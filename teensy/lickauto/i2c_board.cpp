@@ -2,42 +2,368 @@
 #include <i2c_driver.h>
 #include "imx_rt1060/imx_rt1060_i2c_driver.h"
 #include <string.h>
+#include <stddef.h>
+#include <new>
 
 #include "i2c_board.h"
+#include "i2c_devices.h"
 #include "host_comm.h"
 #include "marker.h"
+#include "profile.h"
+#include "telemetry.h"
+#include "triggers.h"
 
 // based on https://github.com/Richard-Gemmell/teensy4_i2c/blob/v2.0.0-beta.2/src/i2c_driver.h
 
+// runs the statement with Driver as the driver of device. It's a switch on the type tag rather than a virtual
+// call, so the driver's steps inline. A new driver gets its case here
+#define WITH_DRIVER(device, ...) \
+  switch (device) \
+  { \
+    case ModIODevice::pcf8574: \
+    { \
+      typedef PCF8574Driver Driver; \
+      __VA_ARGS__; \
+      break; \
+    } \
+    default: \
+    { \
+      typedef ModIODriver Driver; \
+      __VA_ARGS__; \
+      break; \
+    } \
+  }
+
+
+static ModIOBoardPool<NUM_MODIO_BOARDS_MAX, I2C_REQUEST_POOL_N> board_pool;
 
 ModIOBoard* ModIOBoard::boards[NUM_MODIO_BOARDS_MAX] = {NULL};
+uint8_t ModIOBoard::board_slots[NUM_I2C_PORTS][MODIO_ADDRESS_N] = {{0}};
+uint8_t ModIOBoard::free_slots[NUM_MODIO_BOARDS_MAX];
+uint8_t ModIOBoard::free_slots_n = 0;
+// see https://github.com/Richard-Gemmell/teensy4_i2c/tree/master#ports-and-pins for def of ports
+ModIOBus ModIOBoard::buses[NUM_I2C_PORTS] = {ModIOBus(0, Master), ModIOBus(1, Master1), ModIOBus(2, Master2)};
+
+
+// SCL and SDA pins of each port, to clock out a stuck slave while the controller is stopped
+static const uint8_t scl_pins[NUM_I2C_PORTS] = {19, 16, 24};
+static const uint8_t sda_pins[NUM_I2C_PORTS] = {18, 17, 25};
+
+
+// errors of a slave holding SDA or SCL low, which recovering the bus may clear
+static inline bool line_stuck(I2CError err)
+{
+  return err == I2CError::master_pin_low_timeout || err == I2CError::arbitration_lost;
+}
+
+
+ModIOBus::ModIOBus(uint8_t port, I2CMaster& controller) : _controller(controller)
+{
+  _port = port;
+  _freq = ModIOFreq::freq_100k;
+  _pullup = ModIOPullup::disabled;
+  _failures = 0;
+  _recoveries = 0;
+  _boards_n = 0;
+  _next[MODIO_LANE_URGENT] = 0;
+  _next[MODIO_LANE_NORMAL] = 0;
+  _owner = NULL;
+  _orphaned = false;
+  _orphan_us = 0;
+  _orphan_timeout_us = I2C_TIMEOUT_US;
+}
+
+HostError ModIOBus::add_board(ModIOBoard* board, ModIOFreq freq, ModIOPullup pullup)
+{
+  if (_boards_n == NUM_MODIO_BOARDS_MAX)
+    return HostError::no_resource;
+
+  if (_boards_n)
+  {
+    // the port is already running, all boards on it share its settings
+    if (freq != _freq || pullup != _pullup)
+      return HostError::bad_input;
+
+    board->_bus_i = _boards_n;
+    _boards[_boards_n++] = board;
+    return HostError::no_error;
+  }
+
+  if (freq >= ModIOFreq::end || pullup >= ModIOPullup::end)
+    return HostError::bad_input;
+
+  _freq = freq;
+  _pullup = pullup;
+  if (begin() != HostError::no_error)
+    return HostError::i2c_teensy_error;
+
+  _failures = 0;
+  _recoveries = 0;
+  board->_bus_i = _boards_n;
+  _boards[_boards_n++] = board;
+  _next[MODIO_LANE_URGENT] = 0;
+  _next[MODIO_LANE_NORMAL] = 0;
+
+  return HostError::no_error;
+}
+
+void ModIOBus::remove_board(ModIOBoard* board)
+{
+  uint8_t i = board->_bus_i;
+  uint8_t lane = 0;
+
+  if (i >= _boards_n || _boards[i] != board)
+    return;
+
+  // the last board takes its place, so removal doesn't move the others
+  _boards[i] = _boards[--_boards_n];
+  _boards[i]->_bus_i = i;
+  for (; lane < MODIO_LANES_N; lane++)
+  {
+    if (_next[lane] >= _boards_n)
+      _next[lane] = 0;
+  }
+
+  if (_owner == board)
+  {
+    // let its transaction finish before anyone else gets the bus
+    _owner = NULL;
+    _orphaned = true;
+    _orphan_us = micros();
+    _orphan_timeout_us = board->_timeout_us;
+  }
+
+  if (!_boards_n)
+  {
+    _controller.end();
+    _orphaned = false;
+  }
+}
+
+HostError ModIOBus::begin()
+{
+  switch (_pullup)
+  {
+    case ModIOPullup::enabled_22k_ohm:
+      _controller.set_internal_pullups(InternalPullup::enabled_22k_ohm);
+      break;
+    case ModIOPullup::enabled_47k_ohm:
+      _controller.set_internal_pullups(InternalPullup::enabled_47k_ohm);
+      break;
+    case ModIOPullup::enabled_100k_ohm:
+      _controller.set_internal_pullups(InternalPullup::enabled_100k_ohm);
+      break;
+    default:
+      _controller.set_internal_pullups(InternalPullup::disabled);
+      break;
+  }
+
+  switch (_freq)
+  {
+    case ModIOFreq::freq_400k:
+      _controller.begin(400000);
+      break;
+    case ModIOFreq::freq_1m:
+      _controller.begin(1000000);
+      break;
+    default:
+      _controller.begin(100000);
+      break;
+  }
+
+  return _controller.has_error() ? HostError::i2c_teensy_error : HostError::no_error;
+}
+
+void ModIOBus::recover()
+{
+  uint8_t scl = scl_pins[_port];
+  uint8_t sda = sda_pins[_port];
+  uint8_t i = 0;
+
+  _controller.end();
+
+  // a slave that was cut off in the middle of a byte holds SDA low until it's clocked through the rest of
+  // it, at most 9 clocks with the ack. Then a STOP leaves the bus idle
+  pinMode(sda, INPUT_PULLUP);
+  pinMode(scl, OUTPUT_OPENDRAIN);
+  digitalWrite(scl, HIGH);
+  for (; i < 9 && !digitalRead(sda); i++)
+  {
+    digitalWrite(scl, LOW);
+    delayMicroseconds(5);
+    digitalWrite(scl, HIGH);
+    delayMicroseconds(5);
+  }
+
+  pinMode(sda, OUTPUT_OPENDRAIN);
+  digitalWrite(scl, LOW);
+  digitalWrite(sda, LOW);
+  delayMicroseconds(5);
+  digitalWrite(scl, HIGH);
+  delayMicroseconds(5);
+  digitalWrite(sda, HIGH);
+  delayMicroseconds(5);
+
+  // begin gives the pins back to the controller
+  begin();
+  _recoveries++;
+}
+
+void ModIOBus::count_result(bool stuck)
+{
+  if (!stuck)
+    _failures = 0;
+  else if (_failures < UINT8_MAX)
+    _failures++;
+}
+
+void ModIOBus::release(bool reset)
+{
+  _owner = NULL;
+
+  if (_failures >= I2C_RECOVER_FAILURES)
+  {
+    _failures = 0;
+    recover();
+    return;
+  }
+
+  if (!reset)
+    return;
+
+  // the transaction never finished, restart the controller so the next one doesn't overlap with it
+  _controller.end();
+  begin();
+}
+
+void ModIOBus::loop()
+{
+  uint8_t i;
+  uint8_t k;
+  uint8_t lane = 0;
+  uint32_t now;
+  ModIOBoard* board;
+  ModIOBoard* poll = NULL;
+  ModIOBoard* pulse = NULL;
+
+  if (_orphaned)
+  {
+    if (!_controller.finished())
+    {
+      if (micros() - _orphan_us < _orphan_timeout_us)
+        return;
+      count_result(true);
+      release(true);
+    }
+    _orphaned = false;
+  }
+
+  if (_owner != NULL)
+  {
+    if (!_owner->loop_transaction())
+      return;
+  }
+
+  // the bus is free, the pulse edge that's most overdue goes first so the relays switch on time
+  now = micros();
+  for (i = 0; i < _boards_n; i++)
+  {
+    board = _boards[i];
+    if (!board->_pulsing || (int32_t)(now - board->_pulse_due) < 0)
+      continue;
+    if (pulse == NULL || (int32_t)(board->_pulse_due - pulse->_pulse_due) < 0)
+      pulse = board;
+  }
+
+  if (pulse != NULL)
+  {
+    pulse->start_pulse();
+    _owner = pulse;
+    return;
+  }
+
+  // then queued requests by lane and are offered to each board in turn starting after
+  // the last one that had it
+  for (; lane < MODIO_LANES_N; lane++)
+  {
+    for (i = 0; i < _boards_n; i++)
+    {
+      k = (_next[lane] + i) % _boards_n;
+      if (_boards[k]->start_request(lane))
+      {
+        _owner = _boards[k];
+        _next[lane] = (k + 1) % _boards_n;
+        return;
+      }
+    }
+  }
+
+  // then the continuous read whose deadline passed first
+  now = micros();
+  for (i = 0; i < _boards_n; i++)
+  {
+    board = _boards[i];
+    if (!board->_polling || (int32_t)(now - board->_poll_due) < 0)
+      continue;
+    if (poll == NULL || (int32_t)(board->_poll_due - poll->_poll_due) < 0)
+      poll = board;
+  }
+
+  if (poll != NULL)
+  {
+    poll->start_poll(now);
+    _owner = poll;
+  }
+}
+
 
+size_t ModIOBoard::bytes_per_board()
+{
+  return sizeof(ModIOBoard) + (I2C_REQUEST_BUFF_N + I2C_URGENT_BUFF_N) * sizeof(ModIORequest);
+}
+
+size_t ModIOBoard::pool_bytes()
+{
+  return sizeof(board_pool);
+}
 
 void ModIOBoard::setup()
 {
+  uint8_t i = 0;
 
+  // hand out the lowest slots first
+  for (; i < NUM_MODIO_BOARDS_MAX; i++)
+    free_slots[i] = NUM_MODIO_BOARDS_MAX - 1 - i;
+  free_slots_n = NUM_MODIO_BOARDS_MAX;
 }
 
 void ModIOBoard::loop()
 {
+  PROFILE_SCOPE(ProfilePoint::modio_loop);
   uint8_t i = 0;
 
-  for (; i < NUM_MODIO_BOARDS_MAX && boards[i] != NULL; i++)
-    boards[i]->loop_board();
+  for (; i < NUM_I2C_PORTS; i++)
+    buses[i].loop();
 }
 
 void ModIOBoard::host_msg(ModIOData* msg, HostComm* host_comm, StreamMarker* marker)
 {
   // host validated that it's at least size ModIOData
   ModIOBoard* board = locate_board(msg->port, msg->address);
-  uint8_t i = 0;
+  uint8_t i;
+  uint8_t queue_n;
+  uint8_t urgent_n;
   bool respond = true;
   HostError err = HostError::no_error;
 
   switch (msg->cmd)
   {
     case ModIOCmd::create:
-      if (msg->header.len != sizeof(ModIODataCreate))
+      if (
+          msg->header.len != sizeof(ModIODataCreate) && msg->header.len != offsetof(ModIODataCreate, device)
+          && msg->header.len != offsetof(ModIODataCreate, queue_n) && msg->header.len != offsetof(ModIODataCreate, timeout_us)
+          && msg->header.len != offsetof(ModIODataCreate, flags)
+         )
       {
         err = HostError::bad_input;
         break;
@@ -48,41 +374,47 @@ void ModIOBoard::host_msg(ModIOData* msg, HostComm* host_comm, StreamMarker* mar
         break;
       }
 
-      for (i = 0; i < NUM_MODIO_BOARDS_MAX && boards[i] != NULL; i++);
-      if (i == NUM_MODIO_BOARDS_MAX)
+      if (!free_slots_n)
       {
         err = HostError::no_resource;
         break;
       }
+      i = free_slots[free_slots_n - 1];
 
-      switch (((ModIODataCreate*)msg)->header.port)
+      if (msg->port >= NUM_I2C_PORTS)
       {
-        // see https://github.com/Richard-Gemmell/teensy4_i2c/tree/master#ports-and-pins for def of ports
-        case 0:
-          boards[i] = new ModIOBoard((ModIODataCreate*) msg, host_comm, marker, Master, &err);
-          break;
-        case 1:
-          boards[i] = new ModIOBoard((ModIODataCreate*) msg, host_comm, marker, Master1, &err);
-          break;
-        case 2:
-          boards[i] = new ModIOBoard((ModIODataCreate*) msg, host_comm, marker, Master2, &err);
-          break;
-        default:
-          boards[i] = NULL;
-          err = HostError::bad_input;
-          break;
+        err = HostError::bad_input;
+        break;
+      }
+
+      queue_n = I2C_REQUEST_BUFF_N;
+      urgent_n = I2C_URGENT_BUFF_N;
+      if (msg->header.len > offsetof(ModIODataCreate, queue_n))
+      {
+        if (((ModIODataCreate*) msg)->queue_n)
+          queue_n = ((ModIODataCreate*) msg)->queue_n;
+        if (((ModIODataCreate*) msg)->urgent_n)
+          urgent_n = ((ModIODataCreate*) msg)->urgent_n;
       }
 
+      boards[i] = board_pool.create(i, queue_n, urgent_n, (ModIODataCreate*) msg, host_comm, marker, buses[msg->port], &err);
+
       if (err == HostError::no_error && boards[i] == NULL)
         err = HostError::no_resource;
+      if (err == HostError::no_error)
+        err = buses[msg->port].add_board(boards[i], ((ModIODataCreate*) msg)->freq, ((ModIODataCreate*) msg)->pullup);
 
-      if (err != HostError::no_error && boards[i] != NULL)
+      // the slot is only taken once the board is running
+      if (err != HostError::no_error)
       {
-        delete boards[i];
+        if (boards[i] != NULL)
+          board_pool.destroy(i, boards[i]);
         boards[i] = NULL;
         break;
       }
-      
+
+      board_slots[msg->port][msg->address] = i + 1;
+      free_slots_n--;
       break;
 
     case ModIOCmd::remove:
@@ -97,31 +429,153 @@ void ModIOBoard::host_msg(ModIOData* msg, HostComm* host_comm, StreamMarker* mar
         break;
       }
       
-      for (i = 0; boards[i] != board; i++);
-      // move all boards up by one
-      boards[i] = NULL;
-      for (; i < NUM_MODIO_BOARDS_MAX - 1 && boards[i + 1] != NULL; i++)
+      boards[board->_slot] = NULL;
+      board_slots[board->_port][board->_address] = 0;
+      free_slots[free_slots_n++] = board->_slot;
+
+      board->delete_board();
+      board_pool.destroy(board->_slot, board);
+
+      break;
+
+    case ModIOCmd::read_dig_cont_start:
+    case ModIOCmd::read_dig_edges_start:
+      // the poll interval may be left out, then the board is read as often as the bus allows
+      if (msg->cmd == ModIOCmd::read_dig_cont_start)
+        i = msg->header.len == sizeof(ModIOData) || msg->header.len == sizeof(ModIODataCont);
+      else
+        i = msg->header.len == offsetof(ModIODataEdges, interval_us) || msg->header.len == sizeof(ModIODataEdges);
+      if (!i)
+      {
+        err = HostError::bad_input;
+        break;
+      }
+      if (board == NULL)
+      {
+        err = HostError::not_found;
+        break;
+      }
+      if (board->_lanes[lane_of(msg->cmd)].full())
       {
-        boards[i] = boards[i + 1];
-        boards[i + 1] = NULL;
+        err = HostError::no_resource;
+        break;
       }
 
-      board->delete_board();
-      delete board;
+      board->queue_poll(msg);
 
+      respond = false;
+      break;
+
+    case ModIOCmd::poll_stats:
+      if (msg->header.len != sizeof(ModIOData))
+      {
+        err = HostError::bad_input;
+        break;
+      }
+      if (board == NULL)
+      {
+        err = HostError::not_found;
+        break;
+      }
+
+      board->send_poll_stats(msg);
+      respond = false;
+      break;
+
+    case ModIOCmd::queue_stats:
+      if (msg->header.len != sizeof(ModIOData))
+      {
+        err = HostError::bad_input;
+        break;
+      }
+      if (board == NULL)
+      {
+        err = HostError::not_found;
+        break;
+      }
+
+      board->send_queue_stats(msg);
+      respond = false;
+      break;
+
+    case ModIOCmd::health:
+      if (msg->header.len != sizeof(ModIOData))
+      {
+        err = HostError::bad_input;
+        break;
+      }
+      if (board == NULL)
+      {
+        err = HostError::not_found;
+        break;
+      }
+
+      board->send_health(msg);
+      respond = false;
       break;
 
-    case ModIOCmd::address_change:
     case ModIOCmd::write_dig:
+      // the mask may be left out, then all the relays are written
+      if (msg->header.len != sizeof(ModIODataBuff) && msg->header.len != sizeof(ModIODataWriteMask))
+      {
+        err = HostError::bad_input;
+        break;
+      }
+      if (board == NULL)
+      {
+        err = HostError::not_found;
+        break;
+      }
+
+      err = board->queue_write((ModIODataBuff*)msg, msg->header.len == sizeof(ModIODataWriteMask) ? ((ModIODataWriteMask*)msg)->mask : 0xFF);
+      respond = err != HostError::no_error;
+      break;
+
+    case ModIOCmd::write_dig_pulse:
+      if (msg->header.len != sizeof(ModIODataPulse) || !((ModIODataPulse*)msg)->header.value
+          || !((ModIODataPulse*)msg)->on_us || !((ModIODataPulse*)msg)->count)
+      {
+        err = HostError::bad_input;
+        break;
+      }
+      if (board == NULL)
+      {
+        err = HostError::not_found;
+        break;
+      }
+      // one train at a time
+      if (board->_pulse_count)
+      {
+        err = HostError::bad_state;
+        break;
+      }
+      if (board->_lanes[lane_of(msg->cmd)].full())
+      {
+        err = HostError::no_resource;
+        break;
+      }
+
+      board->_pulse_mask = ((ModIODataPulse*)msg)->header.value;
+      board->_pulse_on_us = ((ModIODataPulse*)msg)->on_us;
+      board->_pulse_off_us = ((ModIODataPulse*)msg)->off_us;
+      board->_pulse_count = ((ModIODataPulse*)msg)->count;
+      // the train leaves its relays closed
+      board->_relay_val &= ~board->_pulse_mask;
+      board->queue_request(msg, sizeof(ModIODataBuff));
+
+      respond = false;
+      break;
+
+    case ModIOCmd::address_change:
       if (msg->header.len != sizeof(ModIODataBuff))
       {
         err = HostError::bad_input;
         break;
       }
-    case ModIOCmd::read_dig_cont_start:
+      // fallthrough
     case ModIOCmd::read_dig:
     case ModIOCmd::read_dig_cont_stop:
-      if (msg->cmd != ModIOCmd::write_dig && msg->cmd != ModIOCmd::address_change && msg->header.len != sizeof(ModIOData))
+      if (msg->cmd != ModIOCmd::address_change && msg->header.len != sizeof(ModIOData))
       {
         err = HostError::bad_input;
         break;
@@ -131,19 +585,23 @@ void ModIOBoard::host_msg(ModIOData* msg, HostComm* host_comm, StreamMarker* mar
         err = HostError::not_found;
         break;
       }
-      if (board->_buff_n == I2C_REQUEST_BUFF_N)
+      if (msg->cmd == ModIOCmd::address_change)
+      {
+        WITH_DRIVER(board->_device, i = Driver::address_changeable);
+        if (!i)
+        {
+          err = HostError::bad_input;
+          break;
+        }
+      }
+      if (board->_lanes[lane_of(msg->cmd)].full())
       {
         err = HostError::no_resource;
         break;
       }
 
-      if (msg->cmd == ModIOCmd::read_dig_cont_start)
-        board->_last_read_val = 0xFF;
-      
-      i = (board->_buff_start + board->_buff_n) % I2C_REQUEST_BUFF_N;
-      // either it's of size ModIOData or ModIODataBuff, which is bigger. buff is of size ModIODataBuff
-      memcpy(&board->_request_buff[i], msg, msg->header.len);
-      board->_buff_n++;
+      // either it's of size ModIOData or ModIODataBuff, which is bigger
+      board->queue_request(msg, msg->header.len);
 
       respond = false;
       break;
@@ -165,259 +623,824 @@ void ModIOBoard::host_msg(ModIOData* msg, HostComm* host_comm, StreamMarker* mar
 
 inline ModIOBoard* ModIOBoard::locate_board(uint8_t port, uint8_t address)
 {
-  uint8_t i = 0;
+  uint8_t slot;
 
-  for (; i < NUM_MODIO_BOARDS_MAX && boards[i] != NULL && (boards[i]->_port != port || boards[i]->_address != address); i++);
+  if (port >= NUM_I2C_PORTS || address >= MODIO_ADDRESS_N)
+    return NULL;
 
-  if (i == NUM_MODIO_BOARDS_MAX || boards[i] == NULL)
+  slot = board_slots[port][address];
+  if (!slot)
     return NULL;
-  return boards[i];
+  return boards[slot - 1];
 }
 
-ModIOBoard::ModIOBoard(ModIODataCreate* data, HostComm* host_comm, StreamMarker* marker, I2CMaster& controller, HostError* err) : _controller(controller)
+ModIOBoard::ModIOBoard(ModIODataCreate* data, HostComm* host_comm, StreamMarker* marker, ModIOBus& bus, uint8_t slot, ModIORequest* request_buff, uint8_t buff_size, ModIORequest* urgent_buff, uint8_t urgent_size, HostError* err) : _bus(bus), _controller(bus.controller())
 {
+  uint8_t lane = 0;
+
+  _slot = slot;
+  _lanes[MODIO_LANE_URGENT].init(urgent_buff, urgent_size);
+  _lanes[MODIO_LANE_NORMAL].init(request_buff, buff_size);
+  for (; lane < MODIO_LANES_N; lane++)
+  {
+    _lane_requests[lane] = 0;
+    _lane_wait_us[lane] = 0;
+    _lane_max_wait_us[lane] = 0;
+    _queue_max[lane] = 0;
+    _queued[lane] = 0;
+    _queue_depth_sum[lane] = 0;
+  }
+  for (lane = 0; lane < MODIO_LATENCY_BINS_N; lane++)
+    _latency[lane] = 0;
+  _transactions = 0;
+  _errors = 0;
+  _timeouts = 0;
+  _bus_i = 0;
   _port = data->header.port;
   _address = data->header.address;
   _host_comm = host_comm;
   _marker = marker;
   _working = 0;
+  _bus_held = false;
 
+  _relay_val = 0;
   _last_read_val = 0xFF;
-  _buff_start = 0;
-  _buff_n = 0;
+  _flags = data->header.header.len > offsetof(ModIODataCreate, flags) ? data->flags : 0;
+  _id = data->header.header.id;
+  _device = data->header.header.len > offsetof(ModIODataCreate, device) ? data->device : ModIODevice::mod_io;
+  _timeout_us = data->header.header.len > offsetof(ModIODataCreate, timeout_us) && data->timeout_us ? data->timeout_us : I2C_TIMEOUT_US;
+  _failures = 0;
+  _health = ModIOHealth::ok;
+  _issued_us = 0;
+  _rising_mask = 0;
+  _falling_mask = 0;
+  _edge_started = false;
+  _inputs_known = false;
+  _polling = false;
+  _poll_interval_us = 0;
+  memset(&_poll_next, 0, sizeof(ModIODataEdges));
+  _polls = 0;
+  _poll_missed = 0;
+  _poll_max_late_us = 0;
+  _pulsing = false;
+  _pulse_high = false;
+  _pulse_mask = 0;
+  _pulse_count = 0;
+  _pulses_done = 0;
+  _current = NULL;
+  _current_lane = MODIO_LANE_NORMAL;
 
-  if (_address & 0b10000000)
+  if (_address & 0b10000000 || _device >= ModIODevice::end)
   {
     *err = HostError::bad_input;
     return;
   }
+}
 
-  switch (data->pullup)
+void ModIOBoard::delete_board()
+{
+  ModIOData msg;
+  ModIORequest* request;
+  uint8_t lane = 0;
+
+  // the queued requests, including one on the bus, are answered before their entries go back to the pool. The
+  // bus lets a transaction in flight finish without the board
+  msg.header.len = sizeof(ModIOData);
+  msg.header.code = HostCode::modio_board;
+  msg.header.err = HostError::not_found;
+  msg.port = _port;
+  msg.address = _address;
+  for (; lane < MODIO_LANES_N; lane++)
   {
-    case ModIOPullup::disabled:
-      _controller.set_internal_pullups(InternalPullup::disabled);
-      break;
-    case ModIOPullup::enabled_22k_ohm:
-      _controller.set_internal_pullups(InternalPullup::enabled_22k_ohm);
-      break;
-    case ModIOPullup::enabled_47k_ohm:
-      _controller.set_internal_pullups(InternalPullup::enabled_47k_ohm);
-      break;
-    case ModIOPullup::enabled_100k_ohm:
-      _controller.set_internal_pullups(InternalPullup::enabled_100k_ohm);
-      break;
-    default:
-      *err = HostError::bad_input;
-      return;
+    for (; !_lanes[lane].empty(); _lanes[lane].pop())
+    {
+      request = _lanes[lane].front();
+      // a blanked request was answered already
+      if (request->cmd == ModIOCmd::blank)
+        continue;
+
+      msg.header.id = request->id;
+      msg.cmd = request->cmd;
+      _host_comm->send_to_host(&msg, sizeof(ModIOData));
+    }
   }
 
-  switch (data->freq)
+  // a continuous read or pulse train that's running won't send anything more either
+  if (_polling)
   {
-    case ModIOFreq::freq_100k:
-      _controller.begin(100000);
-      break;
-    case ModIOFreq::freq_400k:
-      _controller.begin(400000);
+    msg.header.id = _poll_msg.header.header.id;
+    msg.cmd = _poll_msg.header.cmd;
+    _host_comm->send_to_host(&msg, sizeof(ModIOData));
+  }
+  if (_pulsing)
+  {
+    msg.header.id = _pulse_msg.header.header.id;
+    msg.cmd = _pulse_msg.header.cmd;
+    _host_comm->send_to_host(&msg, sizeof(ModIOData));
+  }
+
+  _bus.remove_board(this);
+}
+
+bool ModIOBoard::loop_transaction()
+{
+  ModIODataBuff* msg = _current;
+  bool polled = msg == &_poll_msg;
+  bool pulsed = msg == &_pulse_msg;
+  bool last_read_same = false;
+  uint8_t* dev_buff = _bus.dev_buff();
+  uint32_t done_us;
+  uint8_t changed = 0;
+  uint8_t rose = 0;
+  uint8_t fell = 0;
+  HostError mark_err = HostError::no_error;
+
+  if (!_controller.finished())
+  {
+    if (micros() - _issued_us >= _timeout_us)
+    {
+      msg->header.header.err = HostError::timed_out;
+      msg->header.header.len = sizeof(ModIOData);
+      _transactions++;
+      _timeouts++;
+
+      _host_comm->send_to_host(msg, sizeof(ModIOData));
+
+      // a continuous read or pulse train that fails stops, like any other request
+      if (polled)
+        _polling = false;
+      else if (pulsed)
+      {
+        _pulsing = false;
+        _pulse_count = 0;
+      }
+      else
+        pop_request();
+
+      _working = 0;
+      _bus_held = false;
+      count_result(true, true);
+      _bus.release(true);
+      update_health();
+      return true;
+    }
+    return false;
+  }
+  
+  // do read stage if we're reading
+  if (
+      (msg->header.cmd == ModIOCmd::read_dig
+       || msg->header.cmd == ModIOCmd::read_dig_cont_start
+       || msg->header.cmd == ModIOCmd::read_dig_edges_start)
+      && _working == 1
+      && !_controller.has_error()
+     )
+  {
+    WITH_DRIVER(_device, Driver::read(_controller, _address, dev_buff));
+    _bus_held = false;
+    _working++;
+    return false;
+  }
+  
+  // now we're finished reading or writing
+  done_us = micros();
+  _transactions++;
+  if (_controller.has_error())
+    _errors++;
+  _latency[latency_bin(done_us - _issued_us)]++;
+  count_result(_controller.has_error(), line_stuck(_controller.error()));
+  msg->header.header.err = HostError::no_error;
+  msg->header.header.len = sizeof(ModIODataBuff);
+
+  // check if data is unchanged for cont. reading
+  if (_working == 2)
+  {
+    WITH_DRIVER(_device, msg->value = Driver::inputs(dev_buff));
+  }
+  if (msg->header.cmd == ModIOCmd::read_dig_cont_start)
+  {
+    if (_last_read_val == msg->value)
+      last_read_same = true;
+    else
+      _last_read_val = msg->value;
+  }
+
+  switch (msg->header.cmd)
+  {
+    case ModIOCmd::address_change:
+    case ModIOCmd::write_dig:
+    case ModIOCmd::read_dig:
+    case ModIOCmd::read_dig_cont_start:
+      if (_controller.has_error())
+        msg->header.header.err = HostError::i2c_teensy_error;
+      else
+      {
+#if MARKER_ENABLED
+        if (_marker->is_enabled() && !last_read_same)
+          mark_err = _marker->add_mark(&msg->marker);
+#endif
+      }
       break;
-    case ModIOFreq::freq_1m:
-      _controller.begin(1000000);
+
+    case ModIOCmd::read_dig_edges_start:
+    case ModIOCmd::write_dig_pulse:
+      // each edge or pulse ack is marked when it's sent
+      if (_controller.has_error())
+        msg->header.header.err = HostError::i2c_teensy_error;
       break;
+      
     default:
-      *err = HostError::bad_input;
-      return;
+      // shouldn't get here
+      msg->header.header.err = HostError::program_error;
+      break;
   }
 
-  if (_controller.has_error())
+  // the trigger rules see the debounced edges in edge mode, and the changes between reads otherwise
+  if (_working == 2 && msg->header.header.err == HostError::no_error)
+  {
+    if (msg->header.cmd == ModIOCmd::read_dig_edges_start)
+      changed = send_edges(msg, done_us);
+    else
     {
-      *err = HostError::i2c_teensy_error;
-      return;
+      if (_inputs_known)
+        changed = (msg->value ^ _inputs) & ((1 << MODIO_INPUTS_N) - 1);
+      _inputs = msg->value;
+      _inputs_known = true;
+    }
+
+    rose = changed & (msg->header.cmd == ModIOCmd::read_dig_edges_start ? _edge_val : msg->value);
+    fell = changed & ~rose;
+  }
+
+  if (pulsed)
+    send_pulse(msg, done_us);
+  else if (polled && msg->header.header.err == HostError::no_error)
+  {
+    // edge mode sent its edges above, the other reads are only sent if they changed
+    if (msg->header.cmd != ModIOCmd::read_dig_edges_start && !last_read_same)
+      send_response(msg, done_us);
+  }
+  else if (polled)
+  {
+    _polling = false;
+    if (msg->header.cmd == ModIOCmd::read_dig_edges_start)
+    {
+      msg->header.header.len = sizeof(ModIOData);
+      _host_comm->send_to_host(msg, sizeof(ModIOData));
     }
-    
+    else
+      send_response(msg, done_us);
+  }
+  else
+  {
+    pop_request();
+    send_response(msg, done_us);
+  }
+
+  // the transaction went fine, only its marker code was dropped, so the host gets that as a separate frame
+  if (mark_err != HostError::no_error)
+  {
+    msg->header.header.err = mark_err;
+    msg->header.header.len = sizeof(ModIOData);
+    _host_comm->send_to_host(msg, sizeof(ModIOData));
+  }
+
+  // a read that failed after its register write never sent the STOP, reset the bus to send it
+  _working = 0;
+  _bus.release(_bus_held);
+  _bus_held = false;
+  update_health();
+
+  // with the bus free, an action on this port starts right after
+  Triggers::input_edges(_port, _address, rose, fell, done_us, _host_comm);
+  return true;
 }
 
-void ModIOBoard::delete_board()
+void ModIOBoard::send_response(ModIODataBuff* msg, uint32_t done_us)
 {
-  // todo: not sure what happens if in the middle of request. Clean up waiting requests
-  _controller.end();
+  ModIODataBuffTs ts_msg;
+
+  if (!(_flags & MODIO_FLAG_TIMESTAMPS))
+  {
+    _host_comm->send_to_host(msg, sizeof(ModIODataBuff));
+    return;
+  }
+
+  memcpy(&ts_msg.header, msg, sizeof(ModIODataBuff));
+  ts_msg.header.header.header.len = sizeof(ModIODataBuffTs);
+  ts_msg.issued_us = _issued_us;
+  ts_msg.done_us = done_us;
+  _host_comm->send_to_host(&ts_msg, sizeof(ModIODataBuffTs));
 }
 
-void ModIOBoard::loop_board()
+void ModIOBoard::start_edges(ModIODataEdges* msg)
 {
-  uint8_t last_i;
-  uint8_t i;
-  bool last_read_same = false;
+  uint8_t i = 0;
 
-  if (!_buff_n)
-    return;
-  
-  if (_working)
+  _rising_mask = msg->rising_mask;
+  _falling_mask = msg->falling_mask;
+  for (; i < MODIO_INPUTS_N; i++)
+    _debounce_us[i] = (uint32_t)msg->debounce_ms[i] * 1000;
+}
+
+// returns the inputs whose edges were accepted, sent or not
+uint8_t ModIOBoard::send_edges(ModIODataBuff* read_msg, uint32_t done_us)
+{
+  ModIODataEdge msg;
+  uint8_t val = read_msg->value;
+  uint8_t changed;
+  uint8_t accepted = 0;
+  uint8_t edges;
+  uint8_t bit;
+  uint8_t k;
+
+  memcpy(&msg.header, read_msg, sizeof(ModIODataBuff));
+  msg.header.header.header.len = sizeof(ModIODataEdge);
+  if (!_edge_started)
   {
-    if (!_controller.finished())
-    {
-      if (millis() - _last_msg_ts >= 500)
-      {
-        _request_buff[_buff_start].header.header.err = HostError::timed_out;
-        _request_buff[_buff_start].header.header.len = sizeof(ModIOData);
+    _edge_started = true;
+    _edge_val = val;
+    _edge_raw = val;
+    msg.rose = 0;
+    msg.fell = 0;
+    msg.time_us = done_us;
+    _host_comm->send_to_host(&msg, sizeof(ModIODataEdge));
+    return 0;
+  }
 
-        _host_comm->send_to_host(&_request_buff[_buff_start], sizeof(ModIOData));
+  // a bit that changes again restarts its debounce window
+  changed = val ^ _edge_raw;
+  _edge_raw = val;
+  for (k = 0; k < MODIO_INPUTS_N; k++)
+  {
+    bit = 1 << k;
+    if (changed & bit)
+      _edge_raw_us[k] = done_us;
+    if (((val ^ _edge_val) & bit) && done_us - _edge_raw_us[k] >= _debounce_us[k])
+      accepted |= bit;
+  }
+  if (!accepted)
+    return 0;
 
-        _buff_n--;
-        _buff_start++;
-        _buff_start = _buff_start % I2C_REQUEST_BUFF_N;
+  // the reported inputs follow every accepted edge, even those the masks don't send
+  _edge_val ^= accepted;
+  edges = accepted;
+  accepted &= (_edge_val & _rising_mask) | (~_edge_val & _falling_mask);
 
-        _working = 0;
-      }
-      return;
-    }
-    
-    // do read stage if we're reading
-    if (
-        (_request_buff[_buff_start].header.cmd == ModIOCmd::read_dig
-         || _request_buff[_buff_start].header.cmd == ModIOCmd::read_dig_cont_start)
-        && _working == 1
-        && !_controller.has_error()
-       )
-    {
-      _controller.read_async(_address, &_request_buff[_buff_start].value, 1, true);
-      _working++;
-      return;
-    }
-    
-    // now we're finished reading or writing
-    last_i = _buff_start;
-    _request_buff[last_i].header.header.err = HostError::no_error;
-    _request_buff[last_i].header.header.len = sizeof(ModIODataBuff);
-
-    // data was read into the buff directly if reading
-    // check if data is unchanged for cont. reading
-    if (_request_buff[last_i].header.cmd == ModIOCmd::read_dig_cont_start)
+  // bits that changed in the same read are sent together
+  while (accepted)
+  {
+    for (k = 0; !(accepted & (1 << k)); k++);
+    msg.time_us = _edge_raw_us[k];
+    msg.rose = 0;
+    msg.fell = 0;
+    for (; k < MODIO_INPUTS_N; k++)
     {
-      if (_last_read_val == _request_buff[last_i].value)
-        last_read_same = true;
+      bit = 1 << k;
+      if (!(accepted & bit) || _edge_raw_us[k] != msg.time_us)
+        continue;
+
+      if (_edge_val & bit)
+        msg.rose |= bit;
       else
-        _last_read_val = _request_buff[last_i].value;
+        msg.fell |= bit;
+      accepted &= ~bit;
     }
 
-    switch (_request_buff[last_i].header.cmd)
-    {
-      case ModIOCmd::address_change:
-      case ModIOCmd::write_dig:
-      case ModIOCmd::read_dig:
-      case ModIOCmd::read_dig_cont_start:
-        if (_controller.has_error())
-          _request_buff[last_i].header.header.err = HostError::i2c_teensy_error;
-        else
-        {
+    msg.header.value = _edge_val;
+    msg.header.header.header.err = HostError::no_error;
 #if MARKER_ENABLED
-          if (_marker->is_enabled() && !last_read_same)
-            _request_buff[last_i].header.header.err = _marker->add_mark(&_request_buff[last_i].marker);
+    if (_marker->is_enabled())
+      msg.header.header.header.err = _marker->add_mark(&msg.header.marker);
 #endif
-        }
-        break;
-        
-      default:
-        // shouldn't get here
-        _request_buff[last_i].header.header.err = HostError::program_error;
-        break;
-    }
+    _host_comm->send_to_host(&msg, sizeof(ModIODataEdge));
+  }
 
-    // queue it for reading again
-    if (_request_buff[last_i].header.cmd == ModIOCmd::read_dig_cont_start && _request_buff[last_i].header.header.err == HostError::no_error)
-    {
-      if (_buff_n != 1)
-      {
-        _buff_start++;
-        _buff_start = _buff_start % I2C_REQUEST_BUFF_N;
-        
-        // put it at the end
-        if (_buff_n != I2C_REQUEST_BUFF_N)
-          // don't copy if full and it's in place
-          memcpy(&_request_buff[(_buff_start - 1 + _buff_n) % I2C_REQUEST_BUFF_N], &_request_buff[last_i], sizeof(ModIODataBuff));
-      }
+  return edges;
+}
 
-      // only send if it's unchanged
-      if (!last_read_same)
-        _host_comm->send_to_host(&_request_buff[last_i], sizeof(ModIODataBuff));
-    }
-    else
+void ModIOBoard::send_poll_stats(ModIOData* request)
+{
+  ModIODataPollStats msg;
+
+  memcpy(&msg.header, request, sizeof(ModIOData));
+  msg.header.header.len = sizeof(ModIODataPollStats);
+  msg.header.header.err = HostError::no_error;
+  msg.interval_us = _poll_interval_us;
+  msg.active_us = _polling ? micros() - _poll_start_us : 0;
+  msg.polls = _polls;
+  msg.missed = _poll_missed;
+  msg.max_late_us = _poll_max_late_us;
+  _host_comm->send_to_host(&msg, sizeof(ModIODataPollStats));
+}
+
+uint8_t ModIOBoard::lane_of(ModIOCmd cmd)
+{
+  return cmd == ModIOCmd::write_dig || cmd == ModIOCmd::write_dig_pulse ? MODIO_LANE_URGENT : MODIO_LANE_NORMAL;
+}
+
+uint8_t ModIOBoard::latency_bin(uint32_t us)
+{
+  uint8_t bin = 0;
+
+  us >>= MODIO_LATENCY_BIN0_SHIFT;
+  for (; us && bin < MODIO_LATENCY_BINS_N - 1; bin++)
+    us >>= 1;
+  return bin;
+}
+
+void ModIOBoard::queue_request(ModIOData* msg, uint8_t len)
+{
+  uint8_t lane = lane_of(msg->cmd);
+  ModIORequest* request = _lanes[lane].push();
+
+  request->id = msg->header.id;
+  request->cmd = msg->cmd;
+  request->value = len >= sizeof(ModIODataBuff) ? ((ModIODataBuff*)msg)->value : 0;
+  request->queued_us = micros();
+
+  _queued[lane]++;
+  _queue_depth_sum[lane] += _lanes[lane].n();
+  if (_lanes[lane].n() > _queue_max[lane])
+    _queue_max[lane] = _lanes[lane].n();
+}
+
+HostError ModIOBoard::queue_write(ModIODataBuff* msg, uint8_t mask)
+{
+  ModIOQueue& queue = _lanes[MODIO_LANE_URGENT];
+  ModIORequest* pending;
+  ModIOData ack;
+  bool started;
+  uint8_t value = (_relay_val & ~mask) | (msg->value & mask);
+
+  // a pulse train owns its relays and leaves them closed, a write that runs after it mustn't open them
+  if (_pulse_count)
+    value &= ~_pulse_mask;
+
+  if ((_flags & MODIO_FLAG_COALESCE) && !queue.empty())
+  {
+    pending = queue.back();
+    // the front may already be on the bus, and a queued pulse train isn't a write to replace
+    started = _working && _current == &_request_msg && _current_lane == MODIO_LANE_URGENT && pending == queue.front();
+    if (!started && pending->cmd == ModIOCmd::write_dig)
     {
-      _buff_n--;
-      _buff_start++;
-      _buff_start = _buff_start % I2C_REQUEST_BUFF_N;
+      memcpy(&ack, &msg->header, sizeof(ModIOData));
+      ack.header.len = sizeof(ModIOData);
+      ack.header.id = pending->id;
+      ack.header.err = HostError::coalesced;
+      _host_comm->send_to_host(&ack, sizeof(ModIOData));
 
-      _host_comm->send_to_host(&_request_buff[last_i], sizeof(ModIODataBuff));
+      // it keeps its place in the queue, so the wait is counted from the first write
+      pending->id = msg->header.header.id;
+      pending->value = value;
+      _relay_val = value;
+      return HostError::no_error;
     }
+  }
+
+  if (queue.full())
+    return HostError::no_resource;
+
+  msg->value = value;
+  queue_request(&msg->header, sizeof(ModIODataBuff));
+  _relay_val = value;
+  return HostError::no_error;
+}
 
-    _working = 0;
+// the settings are kept by the board until the read starts, the queue only needs the header. There's room for
+// the settings of one, so a continuous read that didn't start yet is replaced by a newer one, which acks it
+// with HostError::coalesced
+void ModIOBoard::queue_poll(ModIOData* msg)
+{
+  ModIOQueue& queue = _lanes[lane_of(msg->cmd)];
+  ModIORequest* pending;
+  ModIOData ack;
+  uint8_t i = 0;
+
+  for (; i < queue.n(); i++)
+  {
+    pending = queue.at(i);
+    if (pending->cmd != ModIOCmd::read_dig_cont_start && pending->cmd != ModIOCmd::read_dig_edges_start)
+      continue;
+
+    memcpy(&ack, msg, sizeof(ModIOData));
+    ack.header.len = sizeof(ModIOData);
+    ack.header.id = pending->id;
+    ack.header.err = HostError::coalesced;
+    ack.cmd = pending->cmd;
+    _host_comm->send_to_host(&ack, sizeof(ModIOData));
+    pending->cmd = ModIOCmd::blank;
   }
 
-  if (!_buff_n)
+  memset(&_poll_next, 0, sizeof(ModIODataEdges));
+  if (msg->cmd == ModIOCmd::read_dig_edges_start)
+    memcpy(&_poll_next, msg, msg->header.len);
+  else if (msg->header.len == sizeof(ModIODataCont))
+    _poll_next.interval_us = ((ModIODataCont*)msg)->interval_us;
+  queue_request(msg, sizeof(ModIOData));
+}
+
+void ModIOBoard::load_request(ModIORequest* request)
+{
+  _request_msg.header.header.len = sizeof(ModIODataBuff);
+  _request_msg.header.header.code = HostCode::modio_board;
+  _request_msg.header.header.id = request->id;
+  _request_msg.header.header.err = HostError::no_error;
+  _request_msg.header.port = _port;
+  _request_msg.header.address = _address;
+  _request_msg.header.cmd = request->cmd;
+  _request_msg.marker = 0;
+  _request_msg.value = request->value;
+}
+
+void ModIOBoard::pop_request()
+{
+  _lanes[_current_lane].pop();
+}
+
+HostError ModIOBoard::telemetry(TelemetryDataBoardStats* msg)
+{
+  ModIOBoard* board;
+  uint8_t i = 0;
+
+  if (msg->header.port >= NUM_I2C_PORTS || msg->header.address >= MODIO_ADDRESS_N)
+    return HostError::bad_input;
+  board = locate_board(msg->header.port, msg->header.address);
+  if (board == NULL)
+    return HostError::not_found;
+
+  msg->header.header.header.len = sizeof(TelemetryDataBoardStats);
+  msg->header.header.header.err = HostError::no_error;
+  msg->transactions = board->_transactions;
+  msg->errors = board->_errors;
+  msg->timeouts = board->_timeouts;
+  for (; i < MODIO_LANES_N; i++)
+  {
+    msg->lanes[i].max = board->_queue_max[i];
+    msg->lanes[i].mean_x100 = board->_queued[i] ? board->_queue_depth_sum[i] * 100 / board->_queued[i] : 0;
+  }
+  for (i = 0; i < MODIO_LATENCY_BINS_N; i++)
+    msg->latency[i] = board->_latency[i];
+  return HostError::no_error;
+}
+
+void ModIOBoard::count_result(bool failed, bool stuck)
+{
+  _bus.count_result(stuck);
+  if (!failed)
+    _failures = 0;
+  else if (_failures < UINT8_MAX)
+    _failures++;
+}
+
+// after the bus is released, so a recovery it did is counted
+void ModIOBoard::update_health()
+{
+  ModIOHealth health = ModIOHealth::ok;
+  ModIOData request;
+
+  if (_failures >= I2C_RECOVER_FAILURES)
+    health = ModIOHealth::failed;
+  else if (_failures)
+    health = ModIOHealth::failing;
+  if (health == _health)
     return;
-  
-  switch (_request_buff[_buff_start].header.cmd)
+
+  _health = health;
+  request.header.code = HostCode::modio_board;
+  request.header.id = _id;
+  request.port = _port;
+  request.address = _address;
+  request.cmd = ModIOCmd::health;
+  send_health(&request);
+}
+
+void ModIOBoard::send_health(ModIOData* request)
+{
+  ModIODataHealth msg;
+
+  memcpy(&msg.header, request, sizeof(ModIOData));
+  msg.header.header.len = sizeof(ModIODataHealth);
+  msg.header.header.err = HostError::no_error;
+  msg.health = _health;
+  msg.failures = _failures;
+  msg.recoveries = _bus.recoveries();
+  msg.timeout_us = _timeout_us;
+  _host_comm->send_to_host(&msg, sizeof(ModIODataHealth));
+}
+
+void ModIOBoard::send_queue_stats(ModIOData* request)
+{
+  ModIODataQueueStats msg;
+  uint8_t lane = 0;
+
+  memcpy(&msg.header, request, sizeof(ModIOData));
+  msg.header.header.len = sizeof(ModIODataQueueStats);
+  msg.header.header.err = HostError::no_error;
+  for (; lane < MODIO_LANES_N; lane++)
   {
-    case ModIOCmd::address_change:
-      _dev_buff[0] = 0xF0;
-      _dev_buff[1] = _request_buff[_buff_start].value;
-      _controller.write_async(_address, _dev_buff, 2, true);
+    msg.lanes[lane].requests = _lane_requests[lane];
+    msg.lanes[lane].mean_us = _lane_requests[lane] ? _lane_wait_us[lane] / _lane_requests[lane] : 0;
+    msg.lanes[lane].max_us = _lane_max_wait_us[lane];
+  }
+  _host_comm->send_to_host(&msg, sizeof(ModIODataQueueStats));
+}
 
-      _last_msg_ts = millis();
-      _working = 1;
-      break;
+void ModIOBoard::start_read(ModIODataBuff* msg)
+{
+  uint8_t* dev_buff = _bus.dev_buff();
+  bool selected = false;
 
-    case ModIOCmd::write_dig:
-      _dev_buff[0] = 0x10;
-      _dev_buff[1] = _request_buff[_buff_start].value;
-      _controller.write_async(_address, _dev_buff, 2, true);
+  // the read follows with a repeated START unless the device needs a STOP in between. A device without
+  // registers is read right away
+  _bus_held = !(_flags & MODIO_FLAG_READ_STOP);
+  WITH_DRIVER(_device, selected = Driver::select(_controller, _address, dev_buff, _bus_held));
+  if (!selected)
+    _bus_held = false;
 
-      _last_msg_ts = millis();
-      _working = 1;
-      break;
+  _issued_us = micros();
+  _working = selected ? 1 : 2;
+  _current = msg;
+}
 
-    case ModIOCmd::read_dig:
-    case ModIOCmd::read_dig_cont_start:
-      _dev_buff[0] = 0x20;
-      _controller.write_async(_address, _dev_buff, 1, true);
-      
-      _last_msg_ts = millis();
-      _working = 1;
-      break;
+void ModIOBoard::start_poll(uint32_t now)
+{
+  uint32_t late = now - _poll_due;
+  uint32_t skipped;
 
-    case ModIOCmd::read_dig_cont_stop:
-      for (i = 0; i < _buff_n; i++)
-      {
-        if (_request_buff[(_buff_start + i) % I2C_REQUEST_BUFF_N].header.cmd == ModIOCmd::read_dig_cont_start)
-        {
-          _request_buff[(_buff_start + i) % I2C_REQUEST_BUFF_N].header.cmd = ModIOCmd::blank;
-          break;
-        }
-      }
+  _polls++;
+  if (!_poll_interval_us)
+    _poll_due = now;
+  else
+  {
+    // deadlines that passed while we were late are skipped, so the reads stay on the interval's grid
+    skipped = late / _poll_interval_us;
+    _poll_missed += skipped;
+    _poll_due += (skipped + 1) * _poll_interval_us;
+    if (late > _poll_max_late_us)
+      _poll_max_late_us = late;
+  }
 
-      _request_buff[_buff_start].header.header.err = HostError::no_error;
-      _request_buff[_buff_start].header.header.len = sizeof(ModIOData);
-      _host_comm->send_to_host(&_request_buff[_buff_start], sizeof(ModIOData));
+  start_read(&_poll_msg);
+}
 
-      _buff_n--;
-      _buff_start++;
-      _buff_start = _buff_start % I2C_REQUEST_BUFF_N;
-      break;
-    
-    case ModIOCmd::blank:
-      // nothing to do, this msg was blanked earlier to be skipped
-      _buff_n--;
-      _buff_start++;
-      _buff_start = _buff_start % I2C_REQUEST_BUFF_N;
-      break;
+void ModIOBoard::start_pulse()
+{
+  uint8_t* dev_buff = _bus.dev_buff();
 
-    default:
-      // shouldn't get here
-      _request_buff[_buff_start].header.header.err = HostError::program_error;
-      _request_buff[_buff_start].header.header.len = sizeof(ModIOData);
-      _host_comm->send_to_host(&_request_buff[_buff_start], sizeof(ModIOData));
+  _pulse_high = !_pulse_high;
+  // the edge only goes into the frame, _relay_val keeps the relays the host queued
+  _pulse_msg.value = (_relay_val & ~_pulse_mask) | (_pulse_high ? _pulse_mask : 0);
+  // the edges stay on the grid of the first one, so a late edge doesn't delay the rest
+  _pulse_due += _pulse_high ? _pulse_on_us : _pulse_off_us;
+
+  WITH_DRIVER(_device, Driver::write(_controller, _address, dev_buff, _pulse_msg.value));
+
+  _issued_us = micros();
+  _working = 1;
+  _current = &_pulse_msg;
+}
+
+void ModIOBoard::send_pulse(ModIODataBuff* msg, uint32_t done_us)
+{
+  ModIODataPulseTs ts_msg;
+
+  if (msg->header.header.err != HostError::no_error)
+  {
+    // the train stops with the relays as they may be, the host has to write them
+    _pulsing = false;
+    _pulse_count = 0;
+    msg->header.header.len = sizeof(ModIOData);
+    _host_comm->send_to_host(msg, sizeof(ModIOData));
+    return;
+  }
+
+  // only the first edge and the last one are acked
+  if (_pulse_high && _pulses_done)
+    return;
+  if (!_pulse_high && ++_pulses_done != _pulse_count)
+    return;
+
+  if (!_pulse_high)
+  {
+    _pulsing = false;
+    _pulse_count = 0;
+  }
+
+  memcpy(&ts_msg.header.header, msg, sizeof(ModIODataBuff));
+  ts_msg.header.header.header.header.len = sizeof(ModIODataPulseTs);
+  ts_msg.header.issued_us = _issued_us;
+  ts_msg.header.done_us = done_us;
+  ts_msg.pulses = _pulses_done;
+#if MARKER_ENABLED
+  if (_marker->is_enabled())
+    ts_msg.header.header.header.header.err = _marker->add_mark(&ts_msg.header.header.marker);
+#endif
+  _host_comm->send_to_host(&ts_msg, sizeof(ModIODataPulseTs));
+}
+
+bool ModIOBoard::start_request(uint8_t lane)
+{
+  ModIOQueue& queue = _lanes[lane];
+  ModIODataBuff* msg;
+  uint32_t wait;
+  uint8_t* dev_buff = _bus.dev_buff();
+
+  _current_lane = lane;
+  // requests that don't need the bus are handled right away, until we reach one that does
+  while (!queue.empty())
+  {
+    load_request(queue.front());
+    msg = &_request_msg;
+
+    wait = micros() - queue.front()->queued_us;
+    _lane_requests[lane]++;
+    _lane_wait_us[lane] += wait;
+    if (wait > _lane_max_wait_us[lane])
+      _lane_max_wait_us[lane] = wait;
+
+    switch (msg->header.cmd)
+    {
+      case ModIOCmd::address_change:
+        WITH_DRIVER(_device, Driver::change_address(_controller, _address, dev_buff, msg->value));
+
+        _issued_us = micros();
+        _working = 1;
+        _current = msg;
+        return true;
+
+      case ModIOCmd::write_dig:
+        // the relays of a running pulse train stay as the train left them
+        if (_pulsing)
+          msg->value = (msg->value & ~_pulse_mask) | (_pulse_high ? _pulse_mask : 0);
+
+        WITH_DRIVER(_device, Driver::write(_controller, _address, dev_buff, msg->value));
+
+        _issued_us = micros();
+        _working = 1;
+        _current = msg;
+        return true;
+
+      case ModIOCmd::read_dig:
+        start_read(msg);
+        return true;
+
+      case ModIOCmd::write_dig_pulse:
+        // the first edge is written now, the others when the bus sees they're due
+        memcpy(&_pulse_msg, msg, sizeof(ModIODataBuff));
+        pop_request();
+
+        _pulsing = true;
+        _pulse_high = false;
+        _pulses_done = 0;
+        _pulse_due = micros();
+        start_pulse();
+        return true;
+
+      case ModIOCmd::read_dig_cont_start:
+      case ModIOCmd::read_dig_edges_start:
+        // from now on the bus reads the board whenever it's due, replacing any earlier continuous read
+        memcpy(&_poll_msg, msg, sizeof(ModIODataBuff));
+        if (msg->header.cmd == ModIOCmd::read_dig_edges_start)
+          start_edges(&_poll_next);
+        _poll_interval_us = _poll_next.interval_us;
+        _polling = true;
+        _last_read_val = 0xFF;
+        _edge_started = false;
+        _poll_start_us = micros();
+        _poll_due = _poll_start_us;
+        _polls = 0;
+        _poll_missed = 0;
+        _poll_max_late_us = 0;
+
+        pop_request();
+        break;
+
+      case ModIOCmd::read_dig_cont_stop:
+        _polling = false;
+
+        msg->header.header.err = HostError::no_error;
+        msg->header.header.len = sizeof(ModIOData);
+        _host_comm->send_to_host(msg, sizeof(ModIOData));
+
+        pop_request();
+        break;
       
-      _buff_n--;
-      _buff_start++;
-      _buff_start = _buff_start % I2C_REQUEST_BUFF_N;
-      break;
+      case ModIOCmd::blank:
+        // nothing to do, this msg was blanked earlier to be skipped
+        pop_request();
+        break;
+
+      default:
+        // shouldn't get here
+        msg->header.header.err = HostError::program_error;
+        msg->header.header.len = sizeof(ModIOData);
+        _host_comm->send_to_host(msg, sizeof(ModIOData));
+        
+        pop_request();
+        break;
+    }
   }
+
+  return false;
 }
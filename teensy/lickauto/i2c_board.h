@@ -5,11 +5,58 @@
 #include <i2c_driver.h>
 #include "imx_rt1060/imx_rt1060_i2c_driver.h"
 #include "host_comm.h"
+#include "i2c_devices.h"
 #include "marker.h"
 
 
+// boards and their request queues are allocated statically, these can be lowered at compile time to save RAM
+#ifndef NUM_MODIO_BOARDS_MAX
 #define NUM_MODIO_BOARDS_MAX 32
+#endif
+// request queue depth of a board unless given at create
+#ifndef I2C_REQUEST_BUFF_N
 #define I2C_REQUEST_BUFF_N 32
+#endif
+// relay writes wait in their own, shorter queue, ahead of every other request
+#ifndef I2C_URGENT_BUFF_N
+#define I2C_URGENT_BUFF_N 8
+#endif
+// entries shared by the queues of all the boards, by default enough for every board at the default depths
+#ifndef I2C_REQUEST_POOL_N
+#define I2C_REQUEST_POOL_N (NUM_MODIO_BOARDS_MAX * (I2C_REQUEST_BUFF_N + I2C_URGENT_BUFF_N))
+#endif
+#define NUM_I2C_PORTS 3
+// 7-bit addresses
+#define MODIO_ADDRESS_N 128
+// a transaction that doesn't finish within the board's timeout fails, this one unless given at create
+#define I2C_TIMEOUT_US 500000
+// after this many transactions in a row on a port timed out or found SDA or SCL held low, the bus is recovered
+// by clocking SCL until a slave that holds SDA low lets go of it, and restarting the controller. A board that
+// NAKs doesn't hold the lines, so its failures only count toward its own health
+#ifndef I2C_RECOVER_FAILURES
+#define I2C_RECOVER_FAILURES 2
+#endif
+
+// priority classes of the queued requests, each board has one queue per lane. Continuous reads are polled
+// below both
+#define MODIO_LANE_URGENT 0
+#define MODIO_LANE_NORMAL 1
+#define MODIO_LANES_N 2
+
+// ModIODataCreate.flags
+// respond to reads and writes with ModIODataBuffTs instead of ModIODataBuff
+#define MODIO_FLAG_TIMESTAMPS 0x01
+// a relay write that's still queued is replaced by a newer one, which acks it with HostError::coalesced
+#define MODIO_FLAG_COALESCE 0x02
+// digital reads send a STOP between writing the register and reading it, instead of a repeated START, for
+// devices that need it
+#define MODIO_FLAG_READ_STOP 0x04
+// transaction times are counted in log2 bins of microseconds for telemetry, bin 0 below 128 us, bin i from
+// 64 << i and the last one anything longer
+#define MODIO_LATENCY_BINS_N 8
+#define MODIO_LATENCY_BIN0_SHIFT 7
+// opto-isolated inputs of a MOD-IO, in the low bits of the value read
+#define MODIO_INPUTS_N 4
 
 
 enum class ModIOCmd : uint8_t {
@@ -20,6 +67,11 @@ enum class ModIOCmd : uint8_t {
   read_dig,
   write_dig,
   address_change,
+  read_dig_edges_start,
+  poll_stats,
+  queue_stats,
+  write_dig_pulse,
+  health,
   blank, // nothing, just a placeholder internally - should not be used externally
   end,
 };
@@ -42,6 +94,24 @@ enum class ModIOFreq : uint8_t {
 };
 
 
+// the driver a board is created with, ModIODriver for mod_io and PCF8574Driver for pcf8574
+enum class ModIODevice : uint8_t {
+  mod_io = 0,
+  pcf8574,
+  end,
+};
+
+
+enum class ModIOHealth : uint8_t {
+  ok = 0,
+  // its last transactions failed
+  failing,
+  // I2C_RECOVER_FAILURES or more failed in a row
+  failed,
+  end,
+};
+
+
 // in case of error, we may respond with just this struct,
 // even if incoming struct had more data appeneded
 struct ModIOData
@@ -52,11 +122,19 @@ struct ModIOData
   ModIOCmd cmd;
 };
 
-struct ModIODataCreate
+// flags, timeout_us, the queue depths and device may be left out by older hosts, then they're 0 and the timeout
+// is I2C_TIMEOUT_US. The queues are taken from the shared pool at the given depths, or the default ones for 0,
+// and create fails with no_resource once the pool has no room left for them
+struct __attribute__((packed)) ModIODataCreate
 {
   ModIOData header;
   ModIOFreq freq;
   ModIOPullup pullup;
+  uint8_t flags;
+  uint32_t timeout_us;
+  uint8_t queue_n;
+  uint8_t urgent_n;
+  ModIODevice device;
 };
 
 struct ModIODataBuff
@@ -66,39 +144,412 @@ struct ModIODataBuff
   uint8_t value;
 };
 
+// read_dig_cont_start with the time between reads. Without it, the board is read as often as the bus allows
+struct __attribute__((packed)) ModIODataCont
+{
+  ModIOData header;
+  uint32_t interval_us;
+};
+
+// continuous reads that only report debounced edges of the inputs selected by the masks. interval_us may be
+// left out like for ModIODataCont
+struct __attribute__((packed)) ModIODataEdges
+{
+  ModIOData header;
+  uint8_t rising_mask;
+  uint8_t falling_mask;
+  // how long each input must hold a new level before the edge is reported
+  uint8_t debounce_ms[MODIO_INPUTS_N];
+  uint32_t interval_us;
+};
+
+// response to poll_stats, about the board's current continuous read
+struct __attribute__((packed)) ModIODataPollStats
+{
+  ModIOData header;
+  uint32_t interval_us;
+  uint32_t active_us;
+  uint32_t polls;
+  // deadlines that passed without a read, and the latest a read started after its deadline
+  uint32_t missed;
+  uint32_t max_late_us;
+};
+
+// response to read_dig_edges_start, with value being the debounced inputs after the edges. The first one
+// after starting has no edges and gives the initial inputs
+struct __attribute__((packed)) ModIODataEdge
+{
+  ModIODataBuff header;
+  uint8_t rose;
+  uint8_t fell;
+  // micros() of the first read that saw the inputs at their new level
+  uint32_t time_us;
+};
+
+// time from a request being received to it being started, for one lane
+struct __attribute__((packed)) ModIOWaitStats
+{
+  uint32_t requests;
+  uint32_t mean_us;
+  uint32_t max_us;
+};
+
+// response to queue_stats, indexed by MODIO_LANE_*
+struct __attribute__((packed)) ModIODataQueueStats
+{
+  ModIOData header;
+  ModIOWaitStats lanes[MODIO_LANES_N];
+};
+
+// response to health, and sent with the id of the create frame whenever the health changes
+struct __attribute__((packed)) ModIODataHealth
+{
+  ModIOData header;
+  ModIOHealth health;
+  // failed transactions in a row, up to 255
+  uint8_t failures;
+  // times the board's port was recovered since it started
+  uint16_t recoveries;
+  uint32_t timeout_us;
+};
+
+// write_dig that only changes the relays in mask, the others keep the last value written to the board
+struct ModIODataWriteMask
+{
+  ModIODataBuff header;
+  uint8_t mask;
+};
+
+// micros() when the board's transaction was started and when the firmware saw it complete
+struct __attribute__((packed)) ModIODataBuffTs
+{
+  ModIODataBuff header;
+  uint32_t issued_us;
+  uint32_t done_us;
+};
+
+// opens the relays in value for on_us, then closes them for off_us, count times. The edges are written on
+// the device's clock, ahead of any other request. While the train runs it owns these relays and write_dig
+// leaves them alone
+struct __attribute__((packed)) ModIODataPulse
+{
+  ModIODataBuff header;
+  uint32_t on_us;
+  uint32_t off_us;
+  uint16_t count;
+};
+
+// response to write_dig_pulse, once when the first pulse opened the relays with pulses 0, and once when the
+// last one closed them. The times are those of the write that did it
+struct __attribute__((packed)) ModIODataPulseTs
+{
+  ModIODataBuffTs header;
+  uint16_t pulses;
+};
+
+
+class ModIOBoard;
+struct TelemetryDataBoardStats;
+
+
+// a request waiting in a board's queue. The rest of its frame is the same for all of the board's requests, so
+// it's rebuilt when the request starts
+struct ModIORequest
+{
+  uint32_t queued_us;
+  uint8_t id;
+  ModIOCmd cmd;
+  uint8_t value;
+};
+
+
+// FIFO of requests in storage owned by the board pool
+class ModIOQueue
+{
+  public:
+    void init(ModIORequest* buff, uint8_t size)
+    {
+      _buff = buff;
+      _size = size;
+      _start = 0;
+      _n = 0;
+    };
+
+    uint8_t n() { return _n; };
+    bool empty() { return !_n; };
+    bool full() { return _n == _size; };
+    ModIORequest* front() { return &_buff[_start]; };
+    ModIORequest* back() { return &_buff[(_start + _n - 1) % _size]; };
+    ModIORequest* at(uint8_t i) { return &_buff[(_start + i) % _size]; };
+
+    ModIORequest* push()
+    {
+      return &_buff[(_start + _n++) % _size];
+    };
+
+    void pop()
+    {
+      _n--;
+      _start = (_start + 1) % _size;
+    };
+
+  private:
+    ModIORequest* _buff;
+    uint8_t _size;
+    uint8_t _start;
+    uint8_t _n;
+};
+
+
+// Owns one I2C port and arbitrates it between all the boards on that port, so only one transaction is ever
+// in flight per port while the three ports run in parallel. Pulse edges that are due go first, then the
+// urgent requests and then the normal ones, each round-robin between the boards, and the continuous reads
+// in deadline order when no request is waiting. A relay write so waits for at most the transaction in
+// flight, the due pulse edges and the urgent requests ahead of it
+class ModIOBus
+{
+  public:
+    ModIOBus(uint8_t port, I2CMaster& controller);
+
+    HostError add_board(ModIOBoard* board, ModIOFreq freq, ModIOPullup pullup);
+    void remove_board(ModIOBoard* board);
+    void loop();
+
+    // a transaction ended, stuck if it timed out or found a line held low
+    void count_result(bool stuck);
+    void release(bool reset);
+
+    I2CMaster& controller() { return _controller; };
+    uint16_t recoveries() { return _recoveries; };
+    uint8_t* dev_buff() { return _dev_buff; };
+
+  private:
+    HostError begin();
+    void recover();
+
+    uint8_t _port;
+    I2CMaster& _controller;
+    ModIOFreq _freq;
+    ModIOPullup _pullup;
+    // stuck transactions in a row, of any board
+    uint8_t _failures;
+    uint16_t _recoveries;
+
+    ModIOBoard* _boards[NUM_MODIO_BOARDS_MAX];
+    uint8_t _boards_n;
+    // per lane, the board that's offered the bus first
+    uint8_t _next[MODIO_LANES_N];
+
+    // board whose transaction is on the bus, or NULL
+    ModIOBoard* _owner;
+    // the transaction of a removed board is still on the bus
+    bool _orphaned;
+    uint32_t _orphan_us;
+    uint32_t _orphan_timeout_us;
+
+    // transactions read and write from here so they don't depend on the board outliving them
+    uint8_t _dev_buff[I2C_DEVICE_BUFF_N];
+};
+
 
 class ModIOBoard
 {
   public:
-    ModIOBoard(ModIODataCreate* data, HostComm* host_comm, StreamMarker* marker, I2CMaster& controller, HostError* err);
+    ModIOBoard(ModIODataCreate* data, HostComm* host_comm, StreamMarker* marker, ModIOBus& bus, uint8_t slot, ModIORequest* request_buff, uint8_t buff_size, ModIORequest* urgent_buff, uint8_t urgent_size, HostError* err);
     void delete_board();
-    void loop_board();
+    bool start_request(uint8_t lane);
+    bool loop_transaction();
 
     static void setup();
     static void loop();
     
     static void host_msg(ModIOData* msg, HostComm* host_comm, StreamMarker* marker);
+    // fills in the counters of the board at the port and address of msg
+    static HostError telemetry(TelemetryDataBoardStats* msg);
+
+    static size_t bytes_per_board();
+    static size_t pool_bytes();
 
   private:
+    friend class ModIOBus;
+
     static inline ModIOBoard* locate_board(uint8_t port, uint8_t address);
+    static uint8_t lane_of(ModIOCmd cmd);
+    static uint8_t latency_bin(uint32_t us);
+    void queue_request(ModIOData* msg, uint8_t len);
+    HostError queue_write(ModIODataBuff* msg, uint8_t mask);
+    void queue_poll(ModIOData* msg);
+    void load_request(ModIORequest* request);
+    void pop_request();
+    void start_read(ModIODataBuff* msg);
+    void start_poll(uint32_t now);
+    void start_pulse();
+    void send_pulse(ModIODataBuff* msg, uint32_t done_us);
+    void send_response(ModIODataBuff* msg, uint32_t done_us);
+    void start_edges(ModIODataEdges* msg);
+    uint8_t send_edges(ModIODataBuff* read_msg, uint32_t done_us);
+    void send_poll_stats(ModIOData* request);
+    void send_queue_stats(ModIOData* request);
+    void send_health(ModIOData* request);
+    void count_result(bool failed, bool stuck);
+    void update_health();
 
+    // index in boards, it doesn't change while the board exists
+    uint8_t _slot;
+    // index in the bus's list of boards
+    uint8_t _bus_i;
     uint8_t _port;
     uint8_t _address;
+    ModIODevice _device;
     uint8_t _last_read_val;
+    uint8_t _flags;
+    // relays as of the last write or pulse train queued, with the train's relays closed as it leaves them.
+    // The edges of a running train are only in the frames written, see start_pulse
+    uint8_t _relay_val;
+
+    // edge reporting state, the inputs as last reported and as last read
+    uint8_t _rising_mask;
+    uint8_t _falling_mask;
+    uint32_t _debounce_us[MODIO_INPUTS_N];
+    uint8_t _edge_val;
+    uint8_t _edge_raw;
+    bool _edge_started;
+    uint32_t _edge_raw_us[MODIO_INPUTS_N];
+    // inputs of the last plain read, to find the edges for the trigger rules
+    uint8_t _inputs;
+    bool _inputs_known;
+
+    // the continuous read isn't queued, the bus starts it once it's due
+    ModIODataBuff _poll_msg;
+    // settings of the continuous read waiting in the queue, applied once it starts
+    ModIODataEdges _poll_next;
+    bool _polling;
+    uint32_t _poll_interval_us;
+    uint32_t _poll_due;
+    uint32_t _poll_start_us;
+    uint32_t _polls;
+    uint32_t _poll_missed;
+    uint32_t _poll_max_late_us;
+
+    // the pulse train, its edges aren't queued either. _pulse_count is non-zero from when it's queued
+    // until it ends
+    ModIODataBuff _pulse_msg;
+    bool _pulsing;
+    bool _pulse_high;
+    uint8_t _pulse_mask;
+    uint16_t _pulse_count;
+    uint16_t _pulses_done;
+    uint32_t _pulse_on_us;
+    uint32_t _pulse_off_us;
+    uint32_t _pulse_due;
     
-    ModIODataBuff _request_buff[I2C_REQUEST_BUFF_N];
-    uint8_t _buff_start;
-    uint8_t _buff_n;
+    ModIOQueue _lanes[MODIO_LANES_N];
+    // frame of the front of _current_lane once it's started
+    ModIODataBuff _request_msg;
+    // request on the bus, either _request_msg, _poll_msg or _pulse_msg
+    ModIODataBuff* _current;
+    uint8_t _current_lane;
+
+    uint32_t _lane_requests[MODIO_LANES_N];
+    uint64_t _lane_wait_us[MODIO_LANES_N];
+    uint32_t _lane_max_wait_us[MODIO_LANES_N];
+    // telemetry, a transaction ends done, with an I2C error or timed out
+    uint32_t _transactions;
+    uint32_t _errors;
+    uint32_t _timeouts;
+    uint32_t _latency[MODIO_LATENCY_BINS_N];
+    uint8_t _queue_max[MODIO_LANES_N];
+    uint32_t _queued[MODIO_LANES_N];
+    uint32_t _queue_depth_sum[MODIO_LANES_N];
+
+    // health, _id is that of the create frame
+    uint8_t _id;
+    uint32_t _timeout_us;
+    uint8_t _failures;
+    ModIOHealth _health;
+
     uint8_t _working;
-    uint _last_msg_ts;
-    uint8_t _dev_buff[4];
+    // the register write of a read ended without a STOP, the read that follows must release the bus
+    bool _bus_held;
+    uint32_t _issued_us;
   
     HostComm* _host_comm;
+    ModIOBus& _bus;
     I2CMaster& _controller;
     StreamMarker* _marker;
 
     static ModIOBoard* boards[];
+    // slot + 1 of the board at each port and address, or 0 if there's none
+    static uint8_t board_slots[NUM_I2C_PORTS][MODIO_ADDRESS_N];
+    static uint8_t free_slots[];
+    static uint8_t free_slots_n;
+    static ModIOBus buses[];
+
+};
+
+
+
+// Static storage for BOARDS_N boards and REQUESTS_N request queue entries that the boards share. A board is
+// constructed in the storage of its slot, and its queues are a run of entries of the depths it asked for, so
+// creating and removing boards never uses the heap
+template <uint8_t BOARDS_N, uint16_t REQUESTS_N>
+class ModIOBoardPool
+{
+  public:
+    // returns NULL if there's no run of queue_n + urgent_n entries left
+    ModIOBoard* create(uint8_t slot, uint8_t queue_n, uint8_t urgent_n, ModIODataCreate* data, HostComm* host_comm, StreamMarker* marker, ModIOBus& bus, HostError* err)
+    {
+      int32_t start = find_run(queue_n + urgent_n);
+
+      if (start < 0)
+        return NULL;
+
+      _starts[slot] = start;
+      _sizes[slot] = queue_n + urgent_n;
+      return new (_boards[slot]) ModIOBoard(data, host_comm, marker, bus, slot, &_requests[start], queue_n, &_requests[start + queue_n], urgent_n, err);
+    };
+
+    void destroy(uint8_t slot, ModIOBoard* board)
+    {
+      board->~ModIOBoard();
+      _sizes[slot] = 0;
+    };
+
+  private:
+    // first fit. A free run starts at the start of the pool or right after the run of a board
+    int32_t find_run(uint16_t n)
+    {
+      uint16_t start = 0;
+      uint16_t i = 0;
+      uint16_t j;
+
+      for (; i <= BOARDS_N; i++)
+      {
+        if (i)
+        {
+          if (!_sizes[i - 1])
+            continue;
+          start = _starts[i - 1] + _sizes[i - 1];
+        }
+        if (start + n > REQUESTS_N)
+          continue;
+
+        for (j = 0; j < BOARDS_N; j++)
+        {
+          if (_sizes[j] && start < _starts[j] + _sizes[j] && _starts[j] < start + n)
+            break;
+        }
+        if (j == BOARDS_N)
+          return start;
+      }
+      return -1;
+    };
 
+    alignas(ModIOBoard) uint8_t _boards[BOARDS_N][sizeof(ModIOBoard)];
+    ModIORequest _requests[REQUESTS_N];
+    // run of entries of the board in each slot, of size 0 while the slot is free
+    uint16_t _starts[BOARDS_N];
+    uint16_t _sizes[BOARDS_N];
 };
 
 #endif
@@ -0,0 +1,104 @@
+#ifndef I2C_DEVICES_H
+#define I2C_DEVICES_H
+
+// uses https://github.com/Richard-Gemmell/teensy4_i2c
+#include <i2c_driver.h>
+
+
+// bytes a driver may write or read in one transaction
+#define I2C_DEVICE_BUFF_N 4
+
+
+// The transaction steps of a device driven as a ModIO board, writing its outputs, reading its inputs and
+// changing its address, built from the register map of Driver, which derives from I2CDevice<Driver>. A driver
+// hides the defaults below where its device differs. Everything is static and resolved at compile time, so
+// the steps inline into the board's state machine
+template <class Driver>
+class I2CDevice
+{
+  public:
+    // the defaults, for a device whose inputs are read right away as a single byte and whose address is fixed
+    static constexpr bool address_changeable = false;
+    static constexpr uint8_t inputs_bytes = 1;
+    static uint8_t inputs_select(uint8_t* /* buff */) { return 0; }
+    static uint8_t inputs_value(const uint8_t* buff) { return buff[0]; }
+    static uint8_t address_frame(uint8_t* /* buff */, uint8_t /* address */) { return 0; }
+
+    static void write(I2CMaster& controller, uint8_t address, uint8_t* buff, uint8_t value)
+    {
+      controller.write_async(address, buff, Driver::outputs_frame(buff, value), true);
+    }
+
+    // returns false if the inputs are being read already, otherwise the select bytes are being written first,
+    // without a STOP if hold, and read() follows
+    static bool select(I2CMaster& controller, uint8_t address, uint8_t* buff, bool hold)
+    {
+      uint8_t n = Driver::inputs_select(buff);
+
+      if (!n)
+      {
+        read(controller, address, buff);
+        return false;
+      }
+      controller.write_async(address, buff, n, !hold);
+      return true;
+    }
+
+    static void read(I2CMaster& controller, uint8_t address, uint8_t* buff)
+    {
+      static_assert(Driver::inputs_bytes <= I2C_DEVICE_BUFF_N, "inputs don't fit the bus buffer");
+      controller.read_async(address, buff, Driver::inputs_bytes, true);
+    }
+
+    static uint8_t inputs(const uint8_t* buff) { return Driver::inputs_value(buff); }
+
+    static void change_address(I2CMaster& controller, uint8_t address, uint8_t* buff, uint8_t new_address)
+    {
+      controller.write_async(address, buff, Driver::address_frame(buff, new_address), true);
+    }
+};
+
+
+// Olimex MOD-IO, relays written to register 0x10, inputs read from 0x20 and its address set with 0xF0
+class ModIODriver : public I2CDevice<ModIODriver>
+{
+  public:
+    static constexpr bool address_changeable = true;
+
+    static uint8_t outputs_frame(uint8_t* buff, uint8_t value)
+    {
+      buff[0] = 0x10;
+      buff[1] = value;
+      return 2;
+    }
+
+    static uint8_t inputs_select(uint8_t* buff)
+    {
+      buff[0] = 0x20;
+      return 1;
+    }
+
+    static uint8_t address_frame(uint8_t* buff, uint8_t address)
+    {
+      buff[0] = 0xF0;
+      buff[1] = address;
+      return 2;
+    }
+};
+
+
+// PCF8574 8-bit quasi-bidirectional port, without registers. P0-P3 drive the relays and P4-P7 are the inputs,
+// which are written high so the device can pull them low
+class PCF8574Driver : public I2CDevice<PCF8574Driver>
+{
+  public:
+    static uint8_t outputs_frame(uint8_t* buff, uint8_t value)
+    {
+      buff[0] = 0xF0 | (value & 0x0F);
+      return 1;
+    }
+
+    static uint8_t inputs_value(const uint8_t* buff) { return buff[0] >> 4; }
+};
+
+#endif
@@ -9,6 +9,8 @@
 #include "i2c_board.h"
 #include "host_comm.h"
 #include "marker.h"
+#include "profile.h"
+#include "telemetry.h"
 #include "utils.h"
 
 
@@ -17,6 +19,7 @@ static StreamMarker marker;
 
 
 void setup() {
+  Profile::setup();
 #if MARKER_ENABLED
   marker.setup(&host_comm);
 #endif
@@ -26,9 +29,13 @@ void setup() {
 
 
 void loop() {
+  // keep the 64-bit clock current between clock syncs
+  micros64();
+  Telemetry::loop(&host_comm);
 #if MARKER_ENABLED
   marker.loop();
 #endif
   host_comm.loop();
   ModIOBoard::loop();
+  host_comm.flush_to_host();
 }
@@ -1,104 +1,261 @@
 #include "Arduino.h"
 #include "marker.h"
 #include "host_comm.h"
+#include "profile.h"
 #include "utils.h"
 
 
+#if MARKER_USE_TIMER
+// the timer callback has no context
+static StreamMarker* timer_marker = NULL;
+
+static void marker_timer_isr()
+{
+  timer_marker->timer_edge();
+}
+#endif
+
+
 StreamMarker::StreamMarker()
 {
   _enabled = false;
+  _parallel = false;
+  _edges_n = MARKER_EDGES_N;
   _sending = false;
+  _max_jitter = 0;
+  _codes_sent = 0;
+  _queue_start = 0;
+  _queue_n = 0;
+  _queue_max = 0;
+  _overflows = 0;
 }
 
 
 void StreamMarker::setup(HostComm* host_comm)
 {
   _host_comm = host_comm;
+#if MARKER_USE_TIMER
+  timer_marker = this;
+#endif
 }
 
 void StreamMarker::loop()
 {
-  uint8_t bit;
+  PROFILE_SCOPE(ProfilePoint::marker_loop);
+#if !MARKER_USE_TIMER
+  if (_sending && (int32_t)(micros() - _edge_due) >= 0)
+    timer_edge();
+#endif
+}
 
-  if (!_sending)
+void StreamMarker::write_edge(uint8_t i)
+{
+  uint8_t k = 0;
+
+  if (!_parallel)
+  {
+    digitalWriteFast(_data_pin, _edges[i] & 0b10 ? HIGH : LOW);
+    digitalWriteFast(_clock_pin, _edges[i] & 0b01 ? HIGH : LOW);
     return;
+  }
 
-  if (_bit_state != -1 && micros() - _start_time < _duration)
+  if (i)
+  {
+    *_strobe_clear = _strobe_mask;
     return;
+  }
 
-  switch (_bit_state)
+  // a whole port is written at once, so all the data pins are set within a few cycles
+  for (; k < _ports_n; k++)
   {
-    case -1:
-    case 1:
-    case 3:
-    case 5:
-    case 7:
-    case 9:
-    case 11:
-    case 13:
-      _bit_state++;
-      bit = 0x80 >> (_bit_state / 2);
-
-      if (_current_code & bit && _data_low)
-        digitalWrite(_data_pin, HIGH);
-      else if (!(_current_code & bit) && !_data_low)
-        digitalWrite(_data_pin, LOW);
-      _data_low = !(_current_code & bit);
-
-      digitalWrite(_clock_pin, HIGH);
-
-      _start_time = micros();
-      break;
+    *_port_clear[k] = _clear_masks[k];
+    *_port_set[k] = _set_masks[k];
+  }
+  *_strobe_set = _strobe_mask;
+}
 
-    case 0:
-      // first bit is sent flipped on clock down
-      if (_current_code & 0b10000000)
-        digitalWrite(_data_pin, LOW);
+void StreamMarker::start_code(uint8_t code)
+{
+  load_code(code);
+  _edge_due = micros() + _duration;
+  _sending = true;
+
+#if MARKER_USE_TIMER
+  _timer.begin(marker_timer_isr, _duration);
+#endif
+}
+
+void StreamMarker::load_code(uint8_t code)
+{
+  uint8_t i = 0;
+  uint8_t bit;
+
+  if (_parallel)
+  {
+    for (; i < _ports_n; i++)
+    {
+      _set_masks[i] = 0;
+      _clear_masks[i] = 0;
+    }
+    for (i = 0; i < MARKER_PARALLEL_BITS_N; i++)
+    {
+      if (code & (1 << i))
+        _set_masks[_bit_ports[i]] |= _bit_masks[i];
       else
-        digitalWrite(_data_pin, HIGH);
-      _data_low = _current_code & 0b10000000;
+        _clear_masks[_bit_ports[i]] |= _bit_masks[i];
+    }
+  }
+  else
+  {
+    // each bit is set on the data pin with the clock going high, and the clock then goes low. The first
+    // bit is also sent flipped on clock down
+    for (; i < 8; i++)
+    {
+      bit = (code & (0x80 >> i)) ? 0b10 : 0;
+      _edges[2 * i] = bit | 0b01;
+      _edges[2 * i + 1] = i ? bit : bit ^ 0b10;
+    }
+  }
 
-      digitalWrite(_clock_pin, LOW);
+  _current_code = code;
+  write_edge(0);
+  _edge_i = 1;
+}
 
-      _start_time = micros();
-      _bit_state++;
-      break;
+void StreamMarker::timer_edge()
+{
+  int32_t jitter = (int32_t)(micros() - _edge_due);
 
-    case 2:
-    case 4:
-    case 6:
-    case 8:
-    case 10:
-    case 12:
-    case 14:
-      digitalWrite(_clock_pin, LOW);
+  if (jitter < 0)
+    jitter = -jitter;
+  if ((uint32_t)jitter > _max_jitter)
+    _max_jitter = jitter;
 
-      _start_time = micros();
-      _bit_state++;
-      break;
+  if (_edge_i < _edges_n)
+  {
+    write_edge(_edge_i);
+    _edge_i++;
+    _edge_due += _duration;
+    return;
+  }
+
+  // the idle period after the last edge is over, start the next code on this same tick
+  _codes_sent++;
+  if (_queue_n)
+  {
+    load_code(_queue[_queue_start]);
+    _edge_due += _duration;
+    _queue_start = (_queue_start + 1) % MARKER_QUEUE_N;
+    _queue_n--;
+    return;
+  }
+
+#if MARKER_USE_TIMER
+  _timer.end();
+#endif
+  _sending = false;
+}
+
+HostError StreamMarker::enable_parallel(MarkerDataEnableParallel* msg)
+{
+  MarkerPortReg reg;
+  uint8_t i = 0;
+  uint8_t k;
+
+  if (msg->strobe_pin >= NUM_DIGITAL_PINS)
+    return HostError::bad_input;
+
+  // group the data pins by the port they're on
+  _ports_n = 0;
+  for (; i < MARKER_PARALLEL_BITS_N; i++)
+  {
+    if (msg->data_pins[i] >= NUM_DIGITAL_PINS)
+      return HostError::bad_input;
+
+    reg = portSetRegister(msg->data_pins[i]);
+    for (k = 0; k < _ports_n && _port_set[k] != reg; k++);
+
+    if (k == _ports_n)
+    {
+      if (_ports_n == MARKER_PORTS_N)
+        return HostError::bad_input;
+
+      _port_set[k] = reg;
+      _port_clear[k] = portClearRegister(msg->data_pins[i]);
+      _ports_n++;
+    }
+
+    _bit_ports[i] = k;
+    _bit_masks[i] = digitalPinToBitMask(msg->data_pins[i]);
+    _data_pins[i] = msg->data_pins[i];
   }
 
-  if (_bit_state == 15)
-    _sending = false;
+  _strobe_pin = msg->strobe_pin;
+  _strobe_set = portSetRegister(_strobe_pin);
+  _strobe_clear = portClearRegister(_strobe_pin);
+  _strobe_mask = digitalPinToBitMask(_strobe_pin);
+
+  for (i = 0; i < MARKER_PARALLEL_BITS_N; i++)
+  {
+    pinMode(_data_pins[i], OUTPUT);
+    digitalWrite(_data_pins[i], LOW);
+  }
+  pinMode(_strobe_pin, OUTPUT);
+  digitalWrite(_strobe_pin, LOW);
+
+  _duration = msg->duration;
+  _parallel = true;
+  _edges_n = MARKER_PARALLEL_EDGES_N;
+
+  return HostError::no_error;
+}
+
+void StreamMarker::release_pins()
+{
+  uint8_t i = 0;
+
+  if (!_parallel)
+  {
+    pinMode(_clock_pin, INPUT);
+    pinMode(_data_pin, INPUT);
+    return;
+  }
+
+  for (; i < MARKER_PARALLEL_BITS_N; i++)
+    pinMode(_data_pins[i], INPUT);
+  pinMode(_strobe_pin, INPUT);
 }
 
 HostError StreamMarker::add_mark(uint8_t* mark)
 {
+  HostError err = HostError::no_error;
+
   if (!_enabled)
     return HostError::not_running;
 
-  if (_sending)
+  // the timer must not finish the current code between checking and queuing
+  noInterrupts();
+  if (!_sending)
   {
+    start_code(get_next_code_val());
     *mark = _current_code;
-    return HostError::no_error;
   }
+  else if (_queue_n == MARKER_QUEUE_N)
+  {
+    _overflows++;
+    err = HostError::overflow;
+  }
+  else
+  {
+    *mark = get_next_code_val();
+    _queue[(_queue_start + _queue_n) % MARKER_QUEUE_N] = *mark;
+    _queue_n++;
+    if (_queue_n > _queue_max)
+      _queue_max = _queue_n;
+  }
+  interrupts();
 
-  _current_code = get_next_code_val();
-  *mark = _current_code;
-  _sending = true;
-  _bit_state = -1;
-
-  return HostError::no_error;
+  return err;
 }
 
 void StreamMarker::host_msg(MarkerData* msg)
@@ -106,6 +263,7 @@ void StreamMarker::host_msg(MarkerData* msg)
   // host validated that it's at least size MarkerData
   MarkerDataEnable* enable_msg;
   MarkerDataItem marker_item;
+  MarkerDataStats stats;
 
   bool respond = true;
   HostError err = HostError::no_error;
@@ -128,10 +286,16 @@ void StreamMarker::host_msg(MarkerData* msg)
       _duration = enable_msg->duration;
       _clock_pin = enable_msg->clock_pin;
       _data_pin = enable_msg->data_pin;
+      _parallel = false;
+      _edges_n = MARKER_EDGES_N;
       _sending = false;
       _enabled = true;
-      _data_low = true;
-      _bit_state = -1;
+      _max_jitter = 0;
+      _codes_sent = 0;
+      _queue_start = 0;
+      _queue_n = 0;
+      _queue_max = 0;
+      _overflows = 0;
 
       pinMode(_clock_pin, OUTPUT);
       digitalWrite(_clock_pin, LOW);
@@ -139,6 +303,33 @@ void StreamMarker::host_msg(MarkerData* msg)
       digitalWrite(_data_pin, LOW);
 
       break;
+
+    case MarkerCmd::enable_parallel:
+      if (msg->header.len != sizeof(MarkerDataEnableParallel))
+      {
+        err = HostError::bad_input;
+        break;
+      }
+      if (_enabled)
+      {
+        err = HostError::bad_state;
+        break;
+      }
+
+      err = enable_parallel((MarkerDataEnableParallel*)msg);
+      if (err != HostError::no_error)
+        break;
+
+      _sending = false;
+      _enabled = true;
+      _max_jitter = 0;
+      _codes_sent = 0;
+      _queue_start = 0;
+      _queue_n = 0;
+      _queue_max = 0;
+      _overflows = 0;
+
+      break;
     
     case MarkerCmd::disable:
       if (msg->header.len != sizeof(MarkerData))
@@ -152,11 +343,14 @@ void StreamMarker::host_msg(MarkerData* msg)
         break;
       }
 
+#if MARKER_USE_TIMER
+      _timer.end();
+#endif
       _sending = false;
       _enabled = false;
+      _queue_n = 0;
 
-      pinMode(_clock_pin, INPUT);
-      pinMode(_data_pin, INPUT);
+      release_pins();
 
       break;
     
@@ -177,6 +371,24 @@ void StreamMarker::host_msg(MarkerData* msg)
       
       break;
 
+    case MarkerCmd::stats:
+      if (msg->header.len != sizeof(MarkerData))
+      {
+        err = HostError::bad_input;
+        break;
+      }
+
+      memcpy(&stats, msg, sizeof(MarkerData));
+      stats.header.header.len = sizeof(MarkerDataStats);
+      stats.max_jitter = _max_jitter;
+      stats.codes_sent = _codes_sent;
+      stats.overflows = _overflows;
+      stats.queue_max = _queue_max;
+      _host_comm->send_to_host(&stats, sizeof(MarkerDataStats));
+      respond = false;
+
+      break;
+
     default:
       err = HostError::bad_input;
       break;
@@ -4,12 +4,30 @@
 #include "host_comm.h"
 
 #define MARKER_ENABLED 1
+// clock the marker bits from a hardware timer interrupt, otherwise they are polled in loop()
+#ifndef MARKER_USE_TIMER
+#define MARKER_USE_TIMER 1
+#endif
+// each code is 16 clock/data edges followed by one idle period before the next code can start
+#define MARKER_EDGES_N 16
+// in parallel mode each code is put on 8 data pins with one strobe pulse
+#define MARKER_PARALLEL_EDGES_N 2
+#define MARKER_PARALLEL_BITS_N 8
+// GPIO ports the parallel data and strobe pins may be spread over
+#define MARKER_PORTS_N 4
+// codes requested while one is being sent wait here and are sent back-to-back
+#define MARKER_QUEUE_N 16
+
+// the GPIO set/clear registers, volatile uint32_t* on the Teensy
+typedef decltype(portSetRegister(0)) MarkerPortReg;
 
 
 enum class MarkerCmd : uint8_t {
   enable = 0,
   disable,
   mark,
+  stats,
+  enable_parallel,
   end,
 };
 
@@ -32,6 +50,16 @@ struct MarkerDataEnable
 };
 
 
+// data_pins[i] carries bit i of the code, and the code is valid while the strobe is high
+struct MarkerDataEnableParallel
+{
+  MarkerData header;
+  uint32_t duration;
+  uint8_t strobe_pin;
+  uint8_t data_pins[MARKER_PARALLEL_BITS_N];
+};
+
+
 struct MarkerDataItem
 {
   MarkerData header;
@@ -39,6 +67,19 @@ struct MarkerDataItem
 };
 
 
+struct __attribute__((packed)) MarkerDataStats
+{
+  MarkerData header;
+  // furthest an edge was from when it was due, in us
+  uint32_t max_jitter;
+  uint32_t codes_sent;
+  // marks rejected because the queue was full
+  uint32_t overflows;
+  // most codes that were waiting at once
+  uint8_t queue_max;
+};
+
+
 class StreamMarker
 {
   public:
@@ -52,21 +93,61 @@ class StreamMarker
 
     bool inline is_enabled() {return _enabled; };
 
+    void timer_edge();
+
   private:
+    void start_code(uint8_t code);
+    void load_code(uint8_t code);
+    void write_edge(uint8_t i);
+    HostError enable_parallel(MarkerDataEnableParallel* msg);
+    void release_pins();
+
     HostComm* _host_comm;
 
     bool _enabled;
+    bool _parallel;
+    uint8_t _edges_n;
     uint32_t _duration;
 
-    uint32_t _start_time;
-    bool _sending;
-    uint8_t _current_code;
-    bool _data_low;
-    int8_t _bit_state;
+    // shared with the timer interrupt
+    volatile bool _sending;
+    volatile uint8_t _current_code;
+    volatile uint8_t _edge_i;
+    volatile uint32_t _edge_due;
+    volatile uint32_t _max_jitter;
+    volatile uint32_t _codes_sent;
+
+    volatile uint8_t _queue[MARKER_QUEUE_N];
+    volatile uint8_t _queue_start;
+    volatile uint8_t _queue_n;
+    uint8_t _queue_max;
+    uint32_t _overflows;
+
+    // clock level in bit 0 and data level in bit 1 of each edge of the current code
+    uint8_t _edges[MARKER_EDGES_N];
     
     uint8_t _clock_pin;
     uint8_t _data_pin;
 
+    // for parallel mode the set/clear registers of each port used, and the bits to set and clear on
+    // each of them for the current code
+    uint8_t _strobe_pin;
+    uint8_t _data_pins[MARKER_PARALLEL_BITS_N];
+    uint8_t _ports_n;
+    MarkerPortReg _port_set[MARKER_PORTS_N];
+    MarkerPortReg _port_clear[MARKER_PORTS_N];
+    uint32_t _set_masks[MARKER_PORTS_N];
+    uint32_t _clear_masks[MARKER_PORTS_N];
+    uint8_t _bit_ports[MARKER_PARALLEL_BITS_N];
+    uint32_t _bit_masks[MARKER_PARALLEL_BITS_N];
+    MarkerPortReg _strobe_set;
+    MarkerPortReg _strobe_clear;
+    uint32_t _strobe_mask;
+
+#if MARKER_USE_TIMER
+    IntervalTimer _timer;
+#endif
+
 };
 
 
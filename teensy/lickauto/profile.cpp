@@ -0,0 +1,27 @@
+#include "Arduino.h"
+#include <string.h>
+
+#include "profile.h"
+
+
+#if PROFILE_ENABLED
+ProfileHist Profile::hists[(uint8_t)ProfilePoint::end];
+#endif
+
+
+void Profile::setup()
+{
+#if PROFILE_ENABLED && defined(ARM_DWT_CTRL_CYCCNTENA)
+  // the core starts the cycle counter, but make sure of it
+  ARM_DEMCR |= ARM_DEMCR_TRCENA;
+  ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+#endif
+  reset();
+}
+
+void Profile::reset()
+{
+#if PROFILE_ENABLED
+  memset(hists, 0, sizeof(hists));
+#endif
+}
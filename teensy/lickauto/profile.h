@@ -0,0 +1,82 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+
+// build with PROFILE_ENABLED 1 to time the hot paths in CPU cycles. Otherwise the scopes compile to nothing
+#ifndef PROFILE_ENABLED
+#define PROFILE_ENABLED 0
+#endif
+
+// times are counted in log2 bins of cycles, bin 0 below 64 cycles, bin i from 32 << i and the last one
+// anything longer
+#define PROFILE_BINS_N 16
+#define PROFILE_BIN0_SHIFT 6
+
+#if PROFILE_ENABLED
+#define PROFILE_SCOPE(point) ProfileScope profile_scope(point)
+#else
+#define PROFILE_SCOPE(point)
+#endif
+
+
+enum class ProfilePoint : uint8_t {
+  host_comm_loop = 0,
+  send_to_host,
+  flush_to_host,
+  modio_loop,
+  marker_loop,
+  end,
+};
+
+
+struct ProfileHist
+{
+  uint32_t count;
+  uint32_t max_cycles;
+  uint64_t total_cycles;
+  uint32_t bins[PROFILE_BINS_N];
+};
+
+
+// Cycle histograms of the profiled scopes, read by the host with TelemetryCmd::profile
+class Profile
+{
+  public:
+    static void setup();
+    static void reset();
+    static ProfileHist* hist(ProfilePoint point) { return &hists[(uint8_t)point]; };
+
+    // the DWT cycle counter on the device, host time at F_CPU in the native build
+    static inline uint32_t cycles() { return ARM_DWT_CYCCNT; };
+
+    static inline void record(ProfilePoint point, uint32_t cycles)
+    {
+      ProfileHist* hist = &hists[(uint8_t)point];
+      uint32_t high = cycles >> PROFILE_BIN0_SHIFT;
+      uint8_t bin = high ? 32 - __builtin_clz(high) : 0;
+
+      hist->count++;
+      hist->total_cycles += cycles;
+      if (cycles > hist->max_cycles)
+        hist->max_cycles = cycles;
+      hist->bins[bin < PROFILE_BINS_N ? bin : PROFILE_BINS_N - 1]++;
+    };
+
+  private:
+    static ProfileHist hists[(uint8_t)ProfilePoint::end];
+};
+
+
+// records the cycles from its construction to the end of the enclosing scope
+class ProfileScope
+{
+  public:
+    ProfileScope(ProfilePoint point) : _point(point), _start(Profile::cycles()) {};
+    ~ProfileScope() { Profile::record(_point, Profile::cycles() - _start); };
+
+  private:
+    ProfilePoint _point;
+    uint32_t _start;
+};
+
+#endif
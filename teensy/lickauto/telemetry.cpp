@@ -0,0 +1,219 @@
+#include "Arduino.h"
+#include <string.h>
+
+#include "telemetry.h"
+#include "host_comm.h"
+#include "i2c_board.h"
+
+
+bool Telemetry::started = false;
+uint32_t Telemetry::last_loop_us = 0;
+uint32_t Telemetry::loops = 0;
+uint64_t Telemetry::loop_total_us = 0;
+uint32_t Telemetry::loop_min_us = UINT32_MAX;
+uint32_t Telemetry::loop_max_us = 0;
+
+bool Telemetry::pushing = false;
+uint8_t Telemetry::push_id = 0;
+uint32_t Telemetry::push_period_us = 0;
+uint32_t Telemetry::push_due = 0;
+
+
+void Telemetry::host_msg(TelemetryData* msg, uint8_t len, HostComm* host_comm)
+{
+  // host validated that it's at least size TelemetryData
+  TelemetryDataBoardStats stats;
+  uint32_t period_us;
+  HostError err = HostError::no_error;
+
+  switch (msg->cmd)
+  {
+    case TelemetryCmd::host:
+      if (len != sizeof(TelemetryData))
+      {
+        err = HostError::bad_input;
+        break;
+      }
+
+      send_host(msg, host_comm);
+      return;
+
+    case TelemetryCmd::board:
+      if (len != sizeof(TelemetryDataBoard))
+      {
+        err = HostError::bad_input;
+        break;
+      }
+
+      memcpy(&stats.header, msg, sizeof(TelemetryDataBoard));
+      err = ModIOBoard::telemetry(&stats);
+      if (err != HostError::no_error)
+        break;
+
+      host_comm->send_to_host(&stats, sizeof(TelemetryDataBoardStats));
+      return;
+
+    case TelemetryCmd::push:
+      if (len != sizeof(TelemetryDataPush))
+      {
+        err = HostError::bad_input;
+        break;
+      }
+      period_us = ((TelemetryDataPush*)msg)->period_us;
+      if (period_us && period_us < TELEMETRY_PUSH_MIN_US)
+      {
+        err = HostError::bad_input;
+        break;
+      }
+
+      pushing = period_us != 0;
+      push_id = msg->header.id;
+      push_period_us = period_us;
+      push_due = micros() + period_us;
+      break;
+
+    case TelemetryCmd::profile:
+      if (len != sizeof(TelemetryDataProfile) || ((TelemetryDataProfile*)msg)->point >= ProfilePoint::end)
+      {
+        err = HostError::bad_input;
+        break;
+      }
+
+      err = send_profile((TelemetryDataProfile*)msg, host_comm);
+      if (err != HostError::no_error)
+        break;
+      return;
+
+    case TelemetryCmd::profile_reset:
+      if (len != sizeof(TelemetryData))
+      {
+        err = HostError::bad_input;
+        break;
+      }
+      if (!PROFILE_ENABLED)
+      {
+        err = HostError::not_running;
+        break;
+      }
+
+      Profile::reset();
+      break;
+
+    default:
+      err = HostError::bad_input;
+      break;
+  }
+
+  // sending back ack or with errors only have the basic headers
+  msg->header.err = err;
+  msg->header.len = sizeof(TelemetryData);
+  host_comm->send_to_host(msg, sizeof(TelemetryData));
+}
+
+void Telemetry::loop(HostComm* host_comm)
+{
+  uint32_t now = micros();
+  uint32_t elapsed = now - last_loop_us;
+  TelemetryData request;
+
+  last_loop_us = now;
+  if (!started)
+    started = true;
+  else
+  {
+    loops++;
+    loop_total_us += elapsed;
+    if (elapsed < loop_min_us)
+      loop_min_us = elapsed;
+    if (elapsed > loop_max_us)
+      loop_max_us = elapsed;
+  }
+
+  if (!pushing || (int32_t)(now - push_due) < 0)
+    return;
+
+  // after falling behind, the next push is a period from now rather than a burst to catch up
+  push_due += push_period_us;
+  if ((int32_t)(now - push_due) >= 0)
+    push_due = now + push_period_us;
+
+  request.header.len = sizeof(TelemetryData);
+  request.header.code = HostCode::telemetry;
+  request.header.id = push_id;
+  request.header.err = HostError::no_error;
+  request.cmd = TelemetryCmd::host;
+  send_host(&request, host_comm);
+  send_boards(push_id, host_comm);
+}
+
+void Telemetry::send_host(TelemetryData* request, HostComm* host_comm)
+{
+  TelemetryDataHost msg;
+
+  memcpy(&msg.header, request, sizeof(TelemetryData));
+  msg.header.header.len = sizeof(TelemetryDataHost);
+  msg.header.header.err = HostError::no_error;
+  msg.bytes_in = host_comm->bytes_in();
+  msg.bytes_out = host_comm->bytes_out();
+  msg.dropped_msgs = host_comm->tx_dropped_msgs();
+  msg.dropped_bytes = host_comm->tx_dropped_bytes();
+  msg.bad_bytes = host_comm->read_bad_bytes();
+  msg.tx_max_held = host_comm->tx_max_held();
+  msg.loops = loops;
+  msg.loop_mean_ns = loops ? loop_total_us * 1000 / loops : 0;
+  msg.loop_min_us = loops ? loop_min_us : 0;
+  msg.loop_max_us = loop_max_us;
+  host_comm->send_to_host(&msg, sizeof(TelemetryDataHost));
+
+  loops = 0;
+  loop_total_us = 0;
+  loop_min_us = UINT32_MAX;
+  loop_max_us = 0;
+}
+
+void Telemetry::send_boards(uint8_t id, HostComm* host_comm)
+{
+  TelemetryDataBoardStats stats;
+  uint8_t port = 0;
+  uint16_t address;
+
+  stats.header.header.header.len = sizeof(TelemetryDataBoard);
+  stats.header.header.header.code = HostCode::telemetry;
+  stats.header.header.header.id = id;
+  stats.header.header.header.err = HostError::no_error;
+  stats.header.header.cmd = TelemetryCmd::board;
+
+  for (; port < NUM_I2C_PORTS; port++)
+  {
+    for (address = 0; address < MODIO_ADDRESS_N; address++)
+    {
+      stats.header.port = port;
+      stats.header.address = address;
+      if (ModIOBoard::telemetry(&stats) == HostError::no_error)
+        host_comm->send_to_host(&stats, sizeof(TelemetryDataBoardStats));
+    }
+  }
+}
+
+HostError Telemetry::send_profile(TelemetryDataProfile* request, HostComm* host_comm)
+{
+#if PROFILE_ENABLED
+  TelemetryDataProfileStats msg;
+  ProfileHist* hist = Profile::hist(request->point);
+
+  memcpy(&msg.header, request, sizeof(TelemetryDataProfile));
+  msg.header.header.header.len = sizeof(TelemetryDataProfileStats);
+  msg.header.header.header.err = HostError::no_error;
+  msg.cycles_per_us = F_CPU / 1000000;
+  msg.count = hist->count;
+  msg.max_cycles = hist->max_cycles;
+  msg.total_cycles = hist->total_cycles;
+  memcpy(msg.bins, hist->bins, sizeof(msg.bins));
+  host_comm->send_to_host(&msg, sizeof(TelemetryDataProfileStats));
+  return HostError::no_error;
+#else
+  (void)request;
+  (void)host_comm;
+  return HostError::not_running;
+#endif
+}
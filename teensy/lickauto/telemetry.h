@@ -0,0 +1,129 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "host_comm.h"
+#include "i2c_board.h"
+#include "profile.h"
+
+
+// the host can't ask for pushes more often than this
+#define TELEMETRY_PUSH_MIN_US 10000
+
+
+enum class TelemetryCmd : uint8_t {
+  host = 0,
+  board,
+  push,
+  profile,
+  profile_reset,
+  end,
+};
+
+
+// in case of error, we may respond with just this struct,
+// even if incoming struct had more data appeneded
+struct TelemetryData
+{
+  HostData header;
+  TelemetryCmd cmd;
+};
+
+// response to host, counting from when the device started. The loop times cover the time since the
+// previous host report
+struct __attribute__((packed)) TelemetryDataHost
+{
+  TelemetryData header;
+  uint32_t bytes_in;
+  uint32_t bytes_out;
+  uint32_t dropped_msgs;
+  uint32_t dropped_bytes;
+  uint32_t bad_bytes;
+  uint16_t tx_max_held;
+  uint32_t loops;
+  uint32_t loop_mean_ns;
+  uint32_t loop_min_us;
+  uint32_t loop_max_us;
+};
+
+// request depths of one of the board's lanes, as seen by each new request including itself
+struct __attribute__((packed)) TelemetryQueue
+{
+  uint8_t max;
+  // mean depth times 100
+  uint16_t mean_x100;
+};
+
+// board asks for the counters of the board at port and address, since it was created. The response
+// appends them
+struct TelemetryDataBoard
+{
+  TelemetryData header;
+  uint8_t port;
+  uint8_t address;
+};
+
+struct __attribute__((packed)) TelemetryDataBoardStats
+{
+  TelemetryDataBoard header;
+  uint32_t transactions;
+  uint32_t errors;
+  uint32_t timeouts;
+  TelemetryQueue lanes[MODIO_LANES_N];
+  // transactions that ended done or with an I2C error, by how long they took
+  uint32_t latency[MODIO_LATENCY_BINS_N];
+};
+
+// sends the host report and that of every board every period_us, with the id of this frame, or stops with 0
+struct __attribute__((packed)) TelemetryDataPush
+{
+  TelemetryData header;
+  uint32_t period_us;
+};
+
+// profile asks for the cycle histogram of one of the profiled scopes since the last profile_reset. Both
+// fail with HostError::not_running unless the firmware was built with PROFILE_ENABLED
+struct TelemetryDataProfile
+{
+  TelemetryData header;
+  ProfilePoint point;
+};
+
+struct __attribute__((packed)) TelemetryDataProfileStats
+{
+  TelemetryDataProfile header;
+  uint16_t cycles_per_us;
+  uint32_t count;
+  uint32_t max_cycles;
+  uint64_t total_cycles;
+  uint32_t bins[PROFILE_BINS_N];
+};
+
+
+// Counts what the device is doing so the host can find the bottleneck of a rig while it runs
+class Telemetry
+{
+  public:
+    static void host_msg(TelemetryData* msg, uint8_t len, HostComm* host_comm);
+    // called at the start of every main loop
+    static void loop(HostComm* host_comm);
+
+  private:
+    static void send_host(TelemetryData* request, HostComm* host_comm);
+    static void send_boards(uint8_t id, HostComm* host_comm);
+    static HostError send_profile(TelemetryDataProfile* request, HostComm* host_comm);
+
+    // loop times since the last host report
+    static bool started;
+    static uint32_t last_loop_us;
+    static uint32_t loops;
+    static uint64_t loop_total_us;
+    static uint32_t loop_min_us;
+    static uint32_t loop_max_us;
+
+    static bool pushing;
+    static uint8_t push_id;
+    static uint32_t push_period_us;
+    static uint32_t push_due;
+};
+
+#endif
@@ -0,0 +1,171 @@
+#include "Arduino.h"
+#include <string.h>
+
+#include "triggers.h"
+#include "host_comm.h"
+#include "i2c_board.h"
+#include "marker.h"
+
+
+TriggerRule Triggers::rules[TRIGGER_RULES_N];
+uint8_t Triggers::rules_n = 0;
+
+
+void Triggers::host_msg(TriggerData* msg, uint8_t len, HostComm* host_comm)
+{
+  // host validated that it's at least size TriggerData
+  TriggerRule* rule = msg->rule < TRIGGER_RULES_N ? &rules[msg->rule] : NULL;
+  HostError err = HostError::no_error;
+  uint8_t i = 0;
+
+  switch (msg->cmd)
+  {
+    case TriggerCmd::add:
+      if (rule == NULL)
+      {
+        err = HostError::bad_input;
+        break;
+      }
+
+      err = add_rule((TriggerDataAdd*)msg, len);
+      break;
+
+    case TriggerCmd::remove:
+      if (len != sizeof(TriggerData) || rule == NULL)
+      {
+        err = HostError::bad_input;
+        break;
+      }
+      if (!rule->used)
+      {
+        err = HostError::not_found;
+        break;
+      }
+
+      rule->used = false;
+      rules_n--;
+      break;
+
+    case TriggerCmd::clear:
+      if (len != sizeof(TriggerData))
+      {
+        err = HostError::bad_input;
+        break;
+      }
+
+      for (; i < TRIGGER_RULES_N; i++)
+        rules[i].used = false;
+      rules_n = 0;
+      break;
+
+    case TriggerCmd::arm:
+      if (len != sizeof(TriggerDataArm) || rule == NULL)
+      {
+        err = HostError::bad_input;
+        break;
+      }
+      if (!rule->used)
+      {
+        err = HostError::not_found;
+        break;
+      }
+
+      rule->armed = ((TriggerDataArm*)msg)->window_us != 0;
+      rule->armed_us = micros();
+      rule->window_us = ((TriggerDataArm*)msg)->window_us;
+      break;
+
+    default:
+      err = HostError::bad_input;
+      break;
+  }
+
+  // sending back ack or with errors only have the basic headers
+  msg->header.err = err;
+  msg->header.len = sizeof(TriggerData);
+  host_comm->send_to_host(msg, sizeof(TriggerData));
+}
+
+HostError Triggers::add_rule(TriggerDataAdd* msg, uint8_t len)
+{
+  TriggerRule* rule = &rules[msg->header.rule];
+  HostData* frame = (HostData*)((uint8_t*)msg + sizeof(TriggerDataAdd));
+  uint8_t frame_len = len - sizeof(TriggerDataAdd);
+
+  if (len < sizeof(TriggerDataAdd) + sizeof(HostData) || frame_len > TRIGGER_FRAME_N || frame->len != frame_len)
+    return HostError::bad_input;
+  if (msg->port >= NUM_I2C_PORTS || msg->address >= MODIO_ADDRESS_N || !(msg->rising_mask | msg->falling_mask))
+    return HostError::bad_input;
+
+  // only actions that don't take anything away from the board being read
+  if (frame->code == HostCode::modio_board)
+  {
+    if (
+        frame_len < sizeof(ModIOData)
+        || (((ModIOData*)frame)->cmd != ModIOCmd::write_dig && ((ModIOData*)frame)->cmd != ModIOCmd::write_dig_pulse)
+       )
+      return HostError::bad_input;
+  }
+  else if (frame->code == HostCode::stream_marker)
+  {
+    if (frame_len < sizeof(MarkerData) || ((MarkerData*)frame)->cmd != MarkerCmd::mark)
+      return HostError::bad_input;
+  }
+  else
+    return HostError::bad_input;
+
+  if (!rule->used)
+    rules_n++;
+  rule->used = true;
+  rule->id = msg->header.header.id;
+  rule->port = msg->port;
+  rule->address = msg->address;
+  rule->rising_mask = msg->rising_mask;
+  rule->falling_mask = msg->falling_mask;
+  rule->flags = msg->flags;
+  rule->armed = false;
+  memcpy(rule->frame, frame, frame_len);
+  return HostError::no_error;
+}
+
+void Triggers::input_edges(uint8_t port, uint8_t address, uint8_t rose, uint8_t fell, uint32_t time_us, HostComm* host_comm)
+{
+  TriggerRule* rule;
+  TriggerDataFired msg;
+  uint8_t frame[TRIGGER_FRAME_N];
+  uint8_t i = 0;
+
+  if (!rules_n || !(rose | fell))
+    return;
+
+  for (; i < TRIGGER_RULES_N; i++)
+  {
+    rule = &rules[i];
+    if (!rule->used || rule->port != port || rule->address != address)
+      continue;
+    if (!(rose & rule->rising_mask) && !(fell & rule->falling_mask))
+      continue;
+
+    if (rule->armed && micros() - rule->armed_us >= rule->window_us)
+      rule->armed = false;
+    if ((rule->flags & TRIGGER_FLAG_ARMED) && !rule->armed)
+      continue;
+    if (rule->flags & TRIGGER_FLAG_ONCE)
+      rule->armed = false;
+
+    // the handler responds in the frame, so the rule's copy is kept for the next time
+    memcpy(frame, rule->frame, rule->frame[0]);
+    host_comm->dispatch(frame, frame[0]);
+
+    msg.header.header.len = sizeof(TriggerDataFired);
+    msg.header.header.code = HostCode::trigger;
+    msg.header.header.id = rule->id;
+    msg.header.header.err = HostError::no_error;
+    msg.header.cmd = TriggerCmd::fired;
+    msg.header.rule = i;
+    msg.rose = rose & rule->rising_mask;
+    msg.fell = fell & rule->falling_mask;
+    msg.time_us = time_us;
+    host_comm->send_to_host(&msg, sizeof(TriggerDataFired));
+  }
+}
@@ -0,0 +1,103 @@
+#ifndef TRIGGERS_H
+#define TRIGGERS_H
+
+#include "host_comm.h"
+
+
+// rules are kept in a fixed table and addressed by their index in it
+#ifndef TRIGGER_RULES_N
+#define TRIGGER_RULES_N 16
+#endif
+// largest action frame a rule can hold
+#define TRIGGER_FRAME_N 24
+
+// TriggerDataAdd.flags
+// only fire while the rule is armed with TriggerCmd::arm
+#define TRIGGER_FLAG_ARMED 0x01
+// firing ends the armed window, so the rule fires at most once per arm
+#define TRIGGER_FLAG_ONCE 0x02
+
+
+enum class TriggerCmd : uint8_t {
+  add = 0,
+  remove,
+  clear,
+  arm,
+  fired, // only sent by the device when a rule fires
+  end,
+};
+
+
+// in case of error, we may respond with just this struct,
+// even if incoming struct had more data appeneded
+struct TriggerData
+{
+  HostData header;
+  TriggerCmd cmd;
+  uint8_t rule;
+};
+
+// replaces the rule with one that fires when an input of the board in rising_mask rises or one in
+// falling_mask falls. It's followed by the complete action frame, a write_dig or write_dig_pulse to any board
+// or a stream marker mark, which is handled as if the host had just sent it
+struct TriggerDataAdd
+{
+  TriggerData header;
+  uint8_t port;
+  uint8_t address;
+  uint8_t rising_mask;
+  uint8_t falling_mask;
+  uint8_t flags;
+};
+
+// arms the rule for window_us from now, or disarms it with 0
+struct __attribute__((packed)) TriggerDataArm
+{
+  TriggerData header;
+  uint32_t window_us;
+};
+
+// sent with the id of the rule's add frame after its action was handled
+struct __attribute__((packed)) TriggerDataFired
+{
+  TriggerData header;
+  uint8_t rose;
+  uint8_t fell;
+  // micros() when the read that saw the edges completed
+  uint32_t time_us;
+};
+
+
+struct TriggerRule
+{
+  bool used;
+  uint8_t id;
+  uint8_t port;
+  uint8_t address;
+  uint8_t rising_mask;
+  uint8_t falling_mask;
+  uint8_t flags;
+  bool armed;
+  uint32_t armed_us;
+  uint32_t window_us;
+  uint8_t frame[TRIGGER_FRAME_N];
+};
+
+
+// Reacts to input edges of the ModIO boards on the device, so a lick can open a valve within one I2C transaction
+// instead of a round trip through the host
+class Triggers
+{
+  public:
+    static void host_msg(TriggerData* msg, uint8_t len, HostComm* host_comm);
+    static void input_edges(uint8_t port, uint8_t address, uint8_t rose, uint8_t fell, uint32_t time_us, HostComm* host_comm);
+
+  private:
+    static HostError add_rule(TriggerDataAdd* msg, uint8_t len);
+
+    static TriggerRule rules[TRIGGER_RULES_N];
+    // rules in use, so boards without any cost nothing
+    static uint8_t rules_n;
+};
+
+#endif
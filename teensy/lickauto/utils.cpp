@@ -19,3 +19,29 @@ uint8_t get_next_code_val() {
 
   return v;
 }
+
+uint64_t micros64() {
+  static uint32_t last = 0;
+  static uint32_t rollovers = 0;
+  uint32_t now = micros();
+
+  if (now < last)
+    rollovers++;
+  last = now;
+
+  return ((uint64_t)rollovers << 32) | now;
+}
+
+uint8_t crc8(const uint8_t* data, uint16_t n) {
+  // CRC-8 with polynomial 0x07 and initial value 0
+  uint8_t crc = 0;
+  uint8_t bit;
+
+  for (; n; n--, data++)
+  {
+    crc ^= *data;
+    for (bit = 0; bit < 8; bit++)
+      crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+  }
+  return crc;
+}
@@ -3,5 +3,9 @@
 
 
 uint8_t get_next_code_val();
+// micros() extended to 64 bits, it must be called at least once per 2^32 us to see every rollover
+uint64_t micros64();
+// CRC-8 of the host frames, polynomial 0x07 and initial value 0
+uint8_t crc8(const uint8_t* data, uint16_t n);
 
 #endif
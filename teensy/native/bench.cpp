@@ -0,0 +1,1111 @@
+// Benchmark driver for the host-native build. It feeds host frames into the firmware through the simulated
+// USB serial, runs the sketch loop() and reports throughput and per-iteration latency percentiles.
+//
+// usage: lickauto_bench [echo|modio|marker] [--iterations=N] [--boards=N] [--latency=us] [--freq=0|1|2]
+//                       [--rate=N] [--write-every=us] [--toggle=us] [--tx-capacity=N] [--drain-every=us]
+//                       [--corrupt-every=N] [--duration=us] [--mark-every=us] [--loop-cost=us]
+//                       [--parallel=0|1] [--timestamps=0|1] [--edges=0|1] [--debounce=ms] [--bounce=us]
+//                       [--poll-every=us] [--read-every=us] [--coalesce=0|1] [--write-burst=N]
+//                       [--read-stop=0|1] [--pulse=us] [--pulses=N] [--schedule-ahead=us] [--trigger=0|1]
+//                       [--journal=0|1] [--stall=us] [--telemetry=us] [--timeout=us] [--stuck-every=us]
+//                       [--queue-n=N] [--urgent-n=N] [--device=0|1]
+//
+// Built with -DLICKAUTO_PROFILE=ON, every scenario also prints the firmware's profiled scopes.
+
+#include "Arduino.h"
+#include "imx_rt1060/imx_rt1060_i2c_driver.h"
+#include "host_comm.h"
+#include "i2c_board.h"
+#include "marker.h"
+#include "profile.h"
+#include "sim.h"
+#include "telemetry.h"
+#include "triggers.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+
+void setup();
+void loop();
+
+
+struct BenchConfig
+{
+  const char* scenario = "modio";
+  uint32_t iterations = 1000000;
+  uint32_t boards = 8;
+  uint32_t latency_us = 0;
+  uint32_t freq = (uint32_t)ModIOFreq::freq_400k;
+  // echo frames sent per iteration
+  uint32_t rate = 1;
+  // time between write_dig frames, each sent to the next board
+  uint32_t write_every = 1000;
+  // time between toggling an input of each simulated board
+  uint32_t toggle = 2000;
+  uint32_t tx_capacity = 4096;
+  // time between the host reading the serial link, to simulate a host that stalls
+  uint32_t drain_every = 0;
+  // every Nth host frame has a bit of its length byte flipped on the way
+  uint32_t corrupt_every = 0;
+  // marker half-period
+  uint32_t duration = 100;
+  // time between mark requests
+  uint32_t mark_every = 5000;
+  // for the marker the clock is virtual, and each loop() takes a random time up to this long
+  uint32_t loop_cost = 40;
+  // put the marker codes on 8 data pins with a strobe
+  uint32_t parallel = 0;
+  // create the boards with MODIO_FLAG_TIMESTAMPS
+  uint32_t timestamps = 0;
+  // read the boards with read_dig_edges_start instead of read_dig_cont_start, debounced this long
+  uint32_t edges = 0;
+  uint32_t debounce = 0;
+  // each input toggle chatters back and forth twice within this time before it settles
+  uint32_t bounce = 0;
+  // continuous read interval of each board, 0 reads as often as the bus allows
+  uint32_t poll_every = 0;
+  // time between read_dig frames, each sent to the next board
+  uint32_t read_every = 0;
+  // create the boards with MODIO_FLAG_COALESCE
+  uint32_t coalesce = 0;
+  // write_dig frames sent to the same board every write_every
+  uint32_t write_burst = 1;
+  // create the boards with MODIO_FLAG_READ_STOP
+  uint32_t read_stop = 0;
+  // every write_every, send the next board a write_dig_pulse train of pulses this long instead of write_dig
+  uint32_t pulse = 0;
+  uint32_t pulses = 1;
+  // wrap the writes and pulses in scheduled frames due this long after they're sent
+  uint32_t schedule_ahead = 0;
+  // a trigger rule writes the relays of each board when one of its inputs rises, instead of write_every
+  uint32_t trigger = 0;
+  // enable the journal, and dump the events the host missed as soon as it sees they're missing
+  uint32_t journal = 0;
+  // the host stops reading once for this long, after running for as long
+  uint32_t stall = 0;
+  // have the device push its telemetry this often
+  uint32_t telemetry = 0;
+  // I2C timeout the boards are created with, 0 for the firmware's default
+  uint32_t timeout = 0;
+  // this often the next board in turn holds SDA low on its next transaction until the bus is recovered
+  uint32_t stuck_every = 0;
+  // queue depths the boards are created with, 0 for the firmware's defaults
+  uint32_t queue_n = 0;
+  uint32_t urgent_n = 0;
+  // ModIODevice of the boards
+  uint32_t device = 0;
+};
+
+
+struct BenchStats
+{
+  uint64_t frames_in = 0;
+  uint64_t frames_out = 0;
+  uint64_t errors = 0;
+  uint64_t dropped = 0;
+  uint64_t edges = 0;
+  uint64_t coalesced = 0;
+  // requests answered with not_found because their board was removed
+  uint64_t removed = 0;
+  uint64_t corrupted = 0;
+  // bad_input frames of HostCode::comm, one per resync
+  uint64_t resyncs = 0;
+  // health frames by ModIOHealth
+  uint64_t health[(uint8_t)ModIOHealth::end] = {};
+  std::vector<uint8_t> pending;
+  // the complete frames are kept when requested
+  bool keep = false;
+  std::vector<std::vector<uint8_t>> frames;
+  // done_us - issued_us of the timestamped responses
+  std::vector<uint32_t> transaction_us;
+  std::vector<ModIODataPollStats> poll_stats;
+  std::vector<ModIODataQueueStats> queue_stats;
+  std::vector<TelemetryDataHost> telemetry_host;
+  std::vector<TelemetryDataBoardStats> telemetry_boards;
+  std::vector<TelemetryDataProfileStats> profiles;
+  // done_us of each board's pulse start ack, and how far each train's end was from its ideal time
+  uint32_t pulse_start_us[NUM_I2C_PORTS][MODIO_ADDRESS_N] = {};
+  std::vector<uint32_t> pulse_error_us;
+  // done_us - at_us of the scheduled frames
+  std::vector<uint32_t> scheduled_late_us;
+  uint64_t fired = 0;
+  // from an input toggle to the relay write a trigger rule made for it finishing on the bus
+  std::vector<uint32_t> reaction_us;
+  // sequence numbers of the journal events received, live or dumped
+  std::vector<bool> journal_seen;
+  size_t journal_missed = 0;
+  // a live event skipped some, or a dump finished, so check what's missing
+  bool journal_gap = false;
+  bool journal_dumping = false;
+  // events before this were overwritten on the device before they could be dumped
+  size_t journal_lost_below = 0;
+};
+
+
+static IMX_RT1060_I2CMaster* ports[] = {&Master, &Master1, &Master2};
+static BenchConfig config;
+static uint8_t next_id = 0;
+
+
+static void send_frame(void* data, uint8_t len, BenchStats& stats)
+{
+  uint8_t sync = HOST_SYNC;
+  uint8_t crc;
+
+  ((HostData*)data)->len = len;
+  ((HostData*)data)->id = next_id++;
+  ((HostData*)data)->err = HostError::no_error;
+  crc = crc8((uint8_t*)data, len);
+  stats.frames_in++;
+  if (config.corrupt_every && stats.frames_in % config.corrupt_every == 0)
+  {
+    ((HostData*)data)->len ^= 1 << stats.frames_in % 8;
+    stats.corrupted++;
+  }
+  sim::host_write(&sync, 1);
+  sim::host_write(data, len);
+  sim::host_write(&crc, 1);
+}
+
+// sends the frame inside a scheduled frame, due schedule_ahead from now
+static void send_scheduled(void* data, uint8_t len, BenchStats& stats)
+{
+  uint8_t buff[sizeof(HostDataScheduled) + HOST_SCHEDULED_FRAME_N];
+  HostDataScheduled* msg = (HostDataScheduled*)buff;
+
+  ((HostData*)data)->len = len;
+  ((HostData*)data)->id = next_id++;
+  ((HostData*)data)->err = HostError::no_error;
+  memcpy(&buff[sizeof(HostDataScheduled)], data, len);
+  msg->header.code = HostCode::scheduled;
+  msg->at_us = sim::now_us() + config.schedule_ahead;
+  send_frame(buff, sizeof(HostDataScheduled) + len, stats);
+}
+
+static void send_modio(ModIOCmd cmd, uint8_t port, uint8_t address, uint8_t value, BenchStats& stats)
+{
+  ModIODataBuff msg;
+
+  msg.header.header.code = HostCode::modio_board;
+  msg.header.port = port;
+  msg.header.address = address;
+  msg.header.cmd = cmd;
+  msg.marker = 0;
+  msg.value = value;
+
+  if (cmd == ModIOCmd::write_dig && config.schedule_ahead)
+    send_scheduled(&msg, sizeof(ModIODataBuff), stats);
+  else if (cmd == ModIOCmd::write_dig || cmd == ModIOCmd::address_change)
+    send_frame(&msg, sizeof(ModIODataBuff), stats);
+  else
+    send_frame(&msg, sizeof(ModIOData), stats);
+}
+
+static void send_create(uint8_t port, uint8_t address, uint8_t freq, BenchStats& stats)
+{
+  ModIODataCreate msg;
+
+  msg.header.header.code = HostCode::modio_board;
+  msg.header.port = port;
+  msg.header.address = address;
+  msg.header.cmd = ModIOCmd::create;
+  msg.freq = (ModIOFreq)freq;
+  msg.pullup = ModIOPullup::disabled;
+  msg.flags = (config.timestamps ? MODIO_FLAG_TIMESTAMPS : 0) | (config.coalesce ? MODIO_FLAG_COALESCE : 0)
+    | (config.read_stop ? MODIO_FLAG_READ_STOP : 0);
+  msg.timeout_us = config.timeout;
+  msg.queue_n = config.queue_n;
+  msg.urgent_n = config.urgent_n;
+  msg.device = (ModIODevice)config.device;
+  send_frame(&msg, sizeof(ModIODataCreate), stats);
+}
+
+static void send_pulse(uint8_t port, uint8_t address, BenchStats& stats)
+{
+  ModIODataPulse msg;
+
+  msg.header.header.header.code = HostCode::modio_board;
+  msg.header.header.port = port;
+  msg.header.header.address = address;
+  msg.header.header.cmd = ModIOCmd::write_dig_pulse;
+  msg.header.marker = 0;
+  msg.header.value = 0x01;
+  msg.on_us = config.pulse;
+  msg.off_us = config.pulse;
+  msg.count = config.pulses;
+  if (config.schedule_ahead)
+    send_scheduled(&msg, sizeof(ModIODataPulse), stats);
+  else
+    send_frame(&msg, sizeof(ModIODataPulse), stats);
+}
+
+static void send_trigger_add(uint8_t rule, uint8_t port, uint8_t address, BenchStats& stats)
+{
+  uint8_t buff[sizeof(TriggerDataAdd) + sizeof(ModIODataBuff)];
+  TriggerDataAdd* msg = (TriggerDataAdd*)buff;
+  ModIODataBuff* action = (ModIODataBuff*)&buff[sizeof(TriggerDataAdd)];
+
+  msg->header.header.code = HostCode::trigger;
+  msg->header.cmd = TriggerCmd::add;
+  msg->header.rule = rule;
+  msg->port = port;
+  msg->address = address;
+  msg->rising_mask = 0x0F;
+  msg->falling_mask = 0;
+  msg->flags = 0;
+
+  action->header.header.len = sizeof(ModIODataBuff);
+  action->header.header.code = HostCode::modio_board;
+  action->header.header.id = rule;
+  action->header.header.err = HostError::no_error;
+  action->header.port = port;
+  action->header.address = address;
+  action->header.cmd = ModIOCmd::write_dig;
+  action->marker = 0;
+  action->value = 0x01;
+  send_frame(buff, sizeof(buff), stats);
+}
+
+static void send_edges_start(uint8_t port, uint8_t address, BenchStats& stats)
+{
+  ModIODataEdges msg;
+
+  msg.header.header.code = HostCode::modio_board;
+  msg.header.port = port;
+  msg.header.address = address;
+  msg.header.cmd = ModIOCmd::read_dig_edges_start;
+  msg.rising_mask = 0x0F;
+  msg.falling_mask = 0x0F;
+  memset(msg.debounce_ms, config.debounce, sizeof(msg.debounce_ms));
+  msg.interval_us = config.poll_every;
+  send_frame(&msg, sizeof(ModIODataEdges), stats);
+}
+
+static void send_cont_start(uint8_t port, uint8_t address, BenchStats& stats)
+{
+  ModIODataCont msg;
+
+  msg.header.header.code = HostCode::modio_board;
+  msg.header.port = port;
+  msg.header.address = address;
+  msg.header.cmd = ModIOCmd::read_dig_cont_start;
+  msg.interval_us = config.poll_every;
+  send_frame(&msg, sizeof(ModIODataCont), stats);
+}
+
+// flips the same input of every board as the given toggle did
+static void toggle_inputs(uint32_t toggle)
+{
+  uint32_t j = 0;
+
+  for (; j < config.boards; j++)
+    ports[j % 3]->sim_find(0x20 + j / 3)->inputs ^= 1 << (toggle + j) % 4;
+}
+
+static void send_journal(JournalCmd cmd, uint32_t from_seq, uint32_t n, BenchStats& stats)
+{
+  HostDataJournalDump msg;
+
+  msg.header.header.code = HostCode::journal;
+  msg.header.cmd = cmd;
+  msg.from_seq = from_seq;
+  msg.n = n;
+  send_frame(&msg, cmd == JournalCmd::dump ? sizeof(HostDataJournalDump) : sizeof(HostDataJournal), stats);
+}
+
+// sequence numbers of the journal events from start to end that the host didn't get
+static size_t journal_missing(BenchStats& stats, size_t start, size_t end, size_t* first, size_t* last)
+{
+  size_t missing = 0;
+  size_t k = start;
+
+  for (; k < end; k++)
+  {
+    if (stats.journal_seen[k])
+      continue;
+    if (!missing++)
+      *first = k;
+    *last = k;
+  }
+  return missing;
+}
+
+// asks for everything still missing in one dump, a new one would replace the one in progress
+static void request_dump(BenchStats& stats)
+{
+  size_t first = 0, last = 0;
+
+  if (stats.journal_dumping || !stats.journal_gap)
+    return;
+
+  stats.journal_gap = false;
+  if (!journal_missing(stats, stats.journal_lost_below, stats.journal_seen.size(), &first, &last))
+    return;
+
+  send_journal(JournalCmd::dump, first, last - first + 1, stats);
+  stats.journal_dumping = true;
+}
+
+static void send_telemetry(TelemetryCmd cmd, uint8_t port, uint8_t address, uint32_t period_us, BenchStats& stats)
+{
+  TelemetryDataBoard msg;
+  TelemetryDataPush push;
+
+  if (cmd == TelemetryCmd::push)
+  {
+    push.header.header.code = HostCode::telemetry;
+    push.header.cmd = cmd;
+    push.period_us = period_us;
+    send_frame(&push, sizeof(TelemetryDataPush), stats);
+    return;
+  }
+
+  msg.header.header.code = HostCode::telemetry;
+  msg.header.cmd = cmd;
+  msg.port = port;
+  msg.address = address;
+  send_frame(&msg, cmd == TelemetryCmd::board ? sizeof(TelemetryDataBoard) : sizeof(TelemetryData), stats);
+}
+
+static void send_echo(BenchStats& stats)
+{
+  HostData msg;
+
+  msg.code = HostCode::echo;
+  send_frame(&msg, sizeof(HostData), stats);
+}
+
+// the last edge of a train is ideally pulses * 2 - 1 pulse lengths after the first
+static void record_pulse(ModIODataPulseTs* msg, BenchStats& stats)
+{
+  ModIOData* header = &msg->header.header.header;
+  uint32_t* start = &stats.pulse_start_us[header->port][header->address];
+  int32_t error;
+
+  if (!msg->pulses)
+  {
+    *start = msg->header.done_us;
+    return;
+  }
+
+  error = (int32_t)(msg->header.done_us - *start - (config.pulses * 2 - 1) * config.pulse);
+  stats.pulse_error_us.push_back(error < 0 ? -error : error);
+}
+
+// reads whatever the firmware wrote and counts the complete frames
+static void drain_host(BenchStats& stats)
+{
+  uint8_t buff[4096];
+  size_t n;
+  size_t i = 0;
+  uint8_t len;
+  uint32_t seq;
+  HostData* header;
+
+  while ((n = sim::host_read(buff, sizeof(buff))) > 0)
+    stats.pending.insert(stats.pending.end(), buff, buff + n);
+
+  while (i < stats.pending.size() && stats.pending[i] && i + stats.pending[i] <= stats.pending.size())
+  {
+    header = (HostData*)&stats.pending[i];
+    len = header->len;
+    i += len;
+    // journal events are counted as the frame they wrap, and only the first time they're received
+    if (header->code == HostCode::journal && len > sizeof(HostDataJournalEvent)
+        && ((HostDataJournal*)header)->cmd == JournalCmd::event)
+    {
+      seq = ((HostDataJournalEvent*)header)->seq;
+      if (seq > stats.journal_seen.size())
+      {
+        stats.journal_missed += seq - stats.journal_seen.size();
+        stats.journal_gap = true;
+      }
+      if (seq >= stats.journal_seen.size())
+        stats.journal_seen.resize(seq + 1, false);
+      if (stats.journal_seen[seq])
+        continue;
+      stats.journal_seen[seq] = true;
+      header = (HostData*)((uint8_t*)header + sizeof(HostDataJournalEvent));
+    }
+    if (header->code == HostCode::journal && len == sizeof(HostDataJournalDump)
+        && ((HostDataJournal*)header)->cmd == JournalCmd::dump)
+    {
+      stats.journal_dumping = false;
+      stats.journal_gap = true;
+      stats.journal_lost_below = ((HostDataJournalDump*)header)->from_seq + ((HostDataJournalDump*)header)->n;
+    }
+    stats.frames_out++;
+    if (header->code == HostCode::comm && header->err == HostError::bad_input)
+      stats.resyncs++;
+    if (header->err == HostError::dropping_data)
+      stats.dropped++;
+    else if (header->err == HostError::coalesced)
+      stats.coalesced++;
+    else if (header->err == HostError::not_found && header->code == HostCode::modio_board
+             && ((ModIOData*)header)->cmd != ModIOCmd::remove)
+      stats.removed++;
+    else if (header->err != HostError::no_error)
+      stats.errors++;
+    if (header->code == HostCode::modio_board && header->len == sizeof(ModIODataEdge))
+      stats.edges += __builtin_popcount(((ModIODataEdge*)header)->rose | ((ModIODataEdge*)header)->fell);
+    if (header->code == HostCode::modio_board && header->len == sizeof(ModIODataPollStats)
+        && ((ModIOData*)header)->cmd == ModIOCmd::poll_stats)
+      stats.poll_stats.push_back(*(ModIODataPollStats*)header);
+    if (header->code == HostCode::modio_board && header->len == sizeof(ModIODataQueueStats)
+        && ((ModIOData*)header)->cmd == ModIOCmd::queue_stats)
+      stats.queue_stats.push_back(*(ModIODataQueueStats*)header);
+    if (header->code == HostCode::telemetry && header->len == sizeof(TelemetryDataHost))
+      stats.telemetry_host.push_back(*(TelemetryDataHost*)header);
+    if (header->code == HostCode::telemetry && header->len == sizeof(TelemetryDataBoardStats))
+      stats.telemetry_boards.push_back(*(TelemetryDataBoardStats*)header);
+    if (header->code == HostCode::telemetry && header->len == sizeof(TelemetryDataProfileStats))
+      stats.profiles.push_back(*(TelemetryDataProfileStats*)header);
+    if (header->code == HostCode::modio_board && header->len == sizeof(ModIODataHealth)
+        && ((ModIOData*)header)->cmd == ModIOCmd::health)
+      stats.health[(uint8_t)((ModIODataHealth*)header)->health]++;
+    if (header->code == HostCode::trigger && header->len == sizeof(TriggerDataFired))
+      stats.fired++;
+    if (header->code == HostCode::scheduled && header->len == sizeof(HostDataScheduledDone))
+      stats.scheduled_late_us.push_back(((HostDataScheduledDone*)header)->done_us - ((HostDataScheduledDone*)header)->at_us);
+    if (header->code == HostCode::modio_board && header->len == sizeof(ModIODataPulseTs)
+        && ((ModIOData*)header)->cmd == ModIOCmd::write_dig_pulse)
+      record_pulse((ModIODataPulseTs*)header, stats);
+    if (header->code == HostCode::modio_board && header->len == sizeof(ModIODataBuffTs))
+      stats.transaction_us.push_back(((ModIODataBuffTs*)header)->done_us - ((ModIODataBuffTs*)header)->issued_us);
+    if (stats.keep)
+      stats.frames.emplace_back((uint8_t*)header, (uint8_t*)header + header->len);
+  }
+  stats.pending.erase(stats.pending.begin(), stats.pending.begin() + i);
+}
+
+static double percentile(std::vector<uint32_t>& sorted, double pct)
+{
+  size_t i = (size_t)(pct / 100. * (double)(sorted.size() - 1));
+  return sorted[i];
+}
+
+// upper bound in ns of the histogram bin the percentile falls in
+static double profile_percentile(const TelemetryDataProfileStats& profile, double pct)
+{
+  uint64_t seen = 0;
+  uint8_t bin = 0;
+
+  for (; bin < PROFILE_BINS_N - 1; bin++)
+  {
+    seen += profile.bins[bin];
+    if (seen >= pct / 100. * profile.count)
+      break;
+  }
+  if (bin == PROFILE_BINS_N - 1)
+    return profile.max_cycles * 1000. / profile.cycles_per_us;
+  return (64 << bin) * 1000. / profile.cycles_per_us;
+}
+
+// asks the firmware for the cycle histogram of every profiled scope, or to clear them
+static void read_profile(bool reset, BenchStats& stats)
+{
+  TelemetryDataProfile msg;
+  uint8_t point = 0;
+
+  if (!PROFILE_ENABLED)
+    return;
+
+  msg.header.header.code = HostCode::telemetry;
+  if (reset)
+  {
+    msg.header.cmd = TelemetryCmd::profile_reset;
+    send_frame(&msg, sizeof(TelemetryData), stats);
+  }
+  for (; !reset && point < (uint8_t)ProfilePoint::end; point++)
+  {
+    msg.header.cmd = TelemetryCmd::profile;
+    msg.point = (ProfilePoint)point;
+    send_frame(&msg, sizeof(TelemetryDataProfile), stats);
+  }
+  loop();
+  drain_host(stats);
+}
+
+static void print_profile(BenchStats& stats)
+{
+  static const char* names[] = {"HostComm::loop", "send_to_host", "flush_to_host", "ModIOBoard::loop",
+                                "StreamMarker::loop"};
+
+  for (const TelemetryDataProfileStats& profile : stats.profiles)
+  {
+    if (!profile.count)
+      continue;
+    printf("profile %s: calls %u, mean %.0f ns, p50 < %.0f ns, p99 < %.0f ns, max %.0f ns\n",
+           names[(uint8_t)profile.header.point], profile.count,
+           profile.total_cycles * 1000. / profile.cycles_per_us / profile.count,
+           profile_percentile(profile, 50), profile_percentile(profile, 99),
+           profile.max_cycles * 1000. / profile.cycles_per_us);
+  }
+}
+
+// the clock or strobe is on pin 2, the serial data on pin 3 and the parallel data on pins 4 - 11
+static void send_marker(MarkerCmd cmd, BenchStats& stats)
+{
+  MarkerDataEnable msg;
+  MarkerDataEnableParallel parallel_msg;
+  uint8_t i = 0;
+
+  msg.header.header.code = HostCode::stream_marker;
+  msg.header.cmd = cmd;
+  msg.duration = config.duration;
+  msg.clock_pin = 2;
+  msg.data_pin = 3;
+
+  if (cmd == MarkerCmd::enable && config.parallel)
+  {
+    parallel_msg.header = msg.header;
+    parallel_msg.header.cmd = MarkerCmd::enable_parallel;
+    parallel_msg.duration = config.duration;
+    parallel_msg.strobe_pin = 2;
+    for (; i < MARKER_PARALLEL_BITS_N; i++)
+      parallel_msg.data_pins[i] = 4 + i;
+    send_frame(&parallel_msg, sizeof(MarkerDataEnableParallel), stats);
+  }
+  else if (cmd == MarkerCmd::enable)
+    send_frame(&msg, sizeof(MarkerDataEnable), stats);
+  else
+    send_frame(&msg, sizeof(MarkerData), stats);
+}
+
+// requests marks while the loop takes a random amount of virtual time, then decodes the codes from the
+// traced marker pins, checks them against the replies and measures how far each edge is from its ideal time
+static int run_marker()
+{
+  BenchStats stats, profile;
+  std::vector<uint8_t> replied, decoded;
+  std::vector<uint32_t> loop_ns;
+  std::chrono::steady_clock::time_point t0, t1;
+  const sim::PinEvent* trace;
+  size_t trace_n, k;
+  MarkerDataStats* device_stats = NULL;
+  uint64_t t_start, code_start = 0;
+  uint64_t max_jitter = 0, jitter;
+  uint32_t i, marks = 0, rnd = 1;
+  uint32_t clock_edges = 0;
+  uint32_t edges_n = config.parallel ? MARKER_PARALLEL_EDGES_N : MARKER_EDGES_N;
+  uint8_t data = 0, code = 0;
+  uint8_t parallel_data = 0;
+
+  sim::reset();
+  sim::use_virtual_clock(true);
+  sim::trace_pins(true);
+  stats.keep = true;
+
+  setup();
+  read_profile(true, profile);
+  send_marker(MarkerCmd::enable, stats);
+  t_start = sim::now_us();
+
+  loop_ns.reserve(config.iterations);
+  for (i = 0; i < config.iterations; i++)
+  {
+    if (sim::now_us() - t_start >= (uint64_t)marks * config.mark_every)
+    {
+      send_marker(MarkerCmd::mark, stats);
+      marks++;
+    }
+
+    t0 = std::chrono::steady_clock::now();
+    loop();
+    t1 = std::chrono::steady_clock::now();
+    loop_ns.push_back((uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count());
+    drain_host(stats);
+
+    rnd = rnd * 1103515245 + 12345;
+    sim::advance_us(1 + (rnd >> 16) % (config.loop_cost ? config.loop_cost : 1));
+  }
+
+  read_profile(false, profile);
+
+  // let the queued codes finish and get the device's own measurement
+  sim::advance_us((MARKER_QUEUE_N + 1) * (edges_n + 1) * config.duration);
+  send_marker(MarkerCmd::stats, stats);
+  loop();
+  drain_host(stats);
+
+  for (k = 0; k < stats.frames.size(); k++)
+  {
+    MarkerData* msg = (MarkerData*)stats.frames[k].data();
+
+    if (msg->header.code != HostCode::stream_marker || msg->header.err != HostError::no_error)
+      continue;
+    if (msg->cmd == MarkerCmd::mark)
+      replied.push_back(((MarkerDataItem*)msg)->marker);
+    else if (msg->cmd == MarkerCmd::stats)
+      device_stats = (MarkerDataStats*)msg;
+  }
+
+  // every code is 16 clock edges, or 2 strobe edges in parallel mode, the first rising at the code start
+  // and each a duration apart
+  trace = sim::pin_trace(&trace_n);
+  for (k = 0; k < trace_n; k++)
+  {
+    if (trace[k].pin == 3 && !config.parallel)
+    {
+      data = trace[k].level;
+      continue;
+    }
+    if (trace[k].pin >= 4 && trace[k].pin < 4 + MARKER_PARALLEL_BITS_N)
+    {
+      parallel_data &= ~(1 << (trace[k].pin - 4));
+      parallel_data |= trace[k].level << (trace[k].pin - 4);
+      continue;
+    }
+    if (trace[k].pin != 2)
+      continue;
+
+    if (clock_edges % edges_n == 0)
+      code_start = trace[k].time_us;
+    jitter = trace[k].time_us - (code_start + (uint64_t)(clock_edges % edges_n) * config.duration);
+    if (jitter > max_jitter)
+      max_jitter = jitter;
+
+    // serial data is set before the clock rises, parallel data is stable until the strobe falls
+    if (trace[k].level && !config.parallel)
+      code = (uint8_t)(code << 1) | data;
+    if (!trace[k].level && config.parallel)
+      code = parallel_data;
+    clock_edges++;
+    if (clock_edges % edges_n == 0)
+      decoded.push_back(code);
+  }
+
+  std::sort(loop_ns.begin(), loop_ns.end());
+
+  printf("scenario: marker, iterations: %u, duration: %u us, loop cost: up to %u us, timer: %s, mode: %s\n",
+         config.iterations, config.duration, config.loop_cost, MARKER_USE_TIMER ? "yes" : "no",
+         config.parallel ? "parallel" : "serial");
+  printf("simulated time: %.3f s, marks requested: %u\n", (sim::now_us() - t_start) / 1e6, marks);
+  printf("codes decoded: %zu, codes replied: %zu, match: %s\n", decoded.size(), replied.size(),
+         decoded == replied ? "yes" : "no");
+  printf("edge jitter from pin trace: max %llu us\n", (unsigned long long)max_jitter);
+  if (device_stats != NULL)
+    printf("edge jitter measured by device: max %u us, codes sent %u, queue max %u, overflows %u\n",
+           device_stats->max_jitter, device_stats->codes_sent, device_stats->queue_max, device_stats->overflows);
+  printf("loop() ns: p50 %.0f, p99 %.0f, max %u\n", percentile(loop_ns, 50), percentile(loop_ns, 99),
+         loop_ns.back());
+  print_profile(profile);
+
+  return decoded == replied ? 0 : 1;
+}
+
+
+static uint32_t parse_arg(const char* arg, const char* name, uint32_t value)
+{
+  size_t n = strlen(name);
+
+  if (strncmp(arg, name, n) == 0 && arg[n] == '=')
+    return (uint32_t)strtoul(arg + n + 1, NULL, 0);
+  return value;
+}
+
+int main(int argc, char** argv)
+{
+  BenchStats stats, teardown, profile;
+  std::vector<uint32_t> loop_ns;
+  std::chrono::steady_clock::time_point start, t0, t1;
+  double elapsed;
+  uint32_t i, j, k;
+  uint32_t writes = 0, reads = 0, toggles = 0, bounces = 0, drains = 0, stucks = 0;
+  uint32_t stuck_count = 0;
+  uint64_t stuck_us = 0;
+  bool still_stuck = false;
+  uint64_t t_start;
+  uint8_t port, address;
+  bool modio;
+  uint64_t polls = 0, missed = 0;
+  uint32_t max_late = 0;
+  double poll_rate = 0;
+  uint64_t lane_requests[MODIO_LANES_N] = {0};
+  double lane_wait[MODIO_LANES_N] = {0};
+  uint32_t lane_max_wait[MODIO_LANES_N] = {0};
+  HostDataScheduled cancel;
+  size_t journal_end = 0, journal_lost = 0, first_missing = 0, last_missing = 0;
+  SimModIO* dev;
+  uint32_t toggle_us = 0;
+  uint32_t relays_seen[NUM_MODIO_BOARDS_MAX] = {0};
+  size_t pushes = 0;
+  uint64_t board_transactions = 0, board_errors = 0, board_timeouts = 0;
+  uint64_t latency[MODIO_LATENCY_BINS_N] = {0};
+  uint8_t queue_max[MODIO_LANES_N] = {0};
+  TelemetryDataHost device = {};
+
+  for (int k = 1; k < argc; k++)
+  {
+    if (argv[k][0] != '-')
+    {
+      config.scenario = argv[k];
+      continue;
+    }
+    config.iterations = parse_arg(argv[k], "--iterations", config.iterations);
+    config.boards = parse_arg(argv[k], "--boards", config.boards);
+    config.latency_us = parse_arg(argv[k], "--latency", config.latency_us);
+    config.freq = parse_arg(argv[k], "--freq", config.freq);
+    config.rate = parse_arg(argv[k], "--rate", config.rate);
+    config.write_every = parse_arg(argv[k], "--write-every", config.write_every);
+    config.toggle = parse_arg(argv[k], "--toggle", config.toggle);
+    config.tx_capacity = parse_arg(argv[k], "--tx-capacity", config.tx_capacity);
+    config.drain_every = parse_arg(argv[k], "--drain-every", config.drain_every);
+    config.corrupt_every = parse_arg(argv[k], "--corrupt-every", config.corrupt_every);
+    config.duration = parse_arg(argv[k], "--duration", config.duration);
+    config.mark_every = parse_arg(argv[k], "--mark-every", config.mark_every);
+    config.loop_cost = parse_arg(argv[k], "--loop-cost", config.loop_cost);
+    config.parallel = parse_arg(argv[k], "--parallel", config.parallel);
+    config.timestamps = parse_arg(argv[k], "--timestamps", config.timestamps);
+    config.edges = parse_arg(argv[k], "--edges", config.edges);
+    config.debounce = parse_arg(argv[k], "--debounce", config.debounce);
+    config.bounce = parse_arg(argv[k], "--bounce", config.bounce);
+    config.poll_every = parse_arg(argv[k], "--poll-every", config.poll_every);
+    config.read_every = parse_arg(argv[k], "--read-every", config.read_every);
+    config.coalesce = parse_arg(argv[k], "--coalesce", config.coalesce);
+    config.write_burst = parse_arg(argv[k], "--write-burst", config.write_burst);
+    config.read_stop = parse_arg(argv[k], "--read-stop", config.read_stop);
+    config.pulse = parse_arg(argv[k], "--pulse", config.pulse);
+    config.pulses = parse_arg(argv[k], "--pulses", config.pulses);
+    config.schedule_ahead = parse_arg(argv[k], "--schedule-ahead", config.schedule_ahead);
+    config.trigger = parse_arg(argv[k], "--trigger", config.trigger);
+    config.journal = parse_arg(argv[k], "--journal", config.journal);
+    config.stall = parse_arg(argv[k], "--stall", config.stall);
+    config.telemetry = parse_arg(argv[k], "--telemetry", config.telemetry);
+    config.timeout = parse_arg(argv[k], "--timeout", config.timeout);
+    config.stuck_every = parse_arg(argv[k], "--stuck-every", config.stuck_every);
+    config.queue_n = parse_arg(argv[k], "--queue-n", config.queue_n);
+    config.urgent_n = parse_arg(argv[k], "--urgent-n", config.urgent_n);
+    config.device = parse_arg(argv[k], "--device", config.device);
+  }
+
+  if (strcmp(config.scenario, "marker") == 0)
+    return run_marker();
+
+  modio = strcmp(config.scenario, "modio") == 0;
+  if (!modio && strcmp(config.scenario, "echo") != 0)
+  {
+    fprintf(stderr, "unknown scenario \"%s\", expected echo, modio or marker\n", config.scenario);
+    return 1;
+  }
+  if (config.boards > NUM_MODIO_BOARDS_MAX)
+    config.boards = NUM_MODIO_BOARDS_MAX;
+
+  sim::reset();
+  sim::set_serial_tx_capacity(config.tx_capacity);
+  for (i = 0; i < 3; i++)
+    ports[i]->sim_set_latency(config.latency_us);
+
+  setup();
+
+  if (modio)
+  {
+    // spread the boards over the three ports and start reading them continuously
+    for (i = 0; i < config.boards; i++)
+    {
+      port = i % 3;
+      address = 0x20 + i / 3;
+      ports[port]->sim_add_modio(address)->pcf8574 = config.device == (uint32_t)ModIODevice::pcf8574;
+      send_create(port, address, config.freq, stats);
+      if (config.edges)
+        send_edges_start(port, address, stats);
+      else
+        send_cont_start(port, address, stats);
+      // one rule per board, while there are enough
+      if (config.trigger && i < TRIGGER_RULES_N)
+        send_trigger_add(i, port, address, stats);
+    }
+    // the rules write the relays instead
+    if (config.trigger)
+      config.write_every = 0;
+    for (i = 0; i < 1000; i++)
+    {
+      loop();
+      drain_host(stats);
+    }
+    stats = BenchStats();
+  }
+
+  if (config.journal)
+  {
+    send_journal(JournalCmd::enable, 0, 0, stats);
+    loop();
+    drain_host(stats);
+    stats = BenchStats();
+  }
+
+  // the first report of the run then covers just the run, like the profile
+  read_profile(true, stats);
+  send_telemetry(TelemetryCmd::host, 0, 0, 0, stats);
+  if (config.telemetry)
+    send_telemetry(TelemetryCmd::push, 0, 0, config.telemetry, stats);
+  loop();
+  drain_host(stats);
+  stats = BenchStats();
+
+  loop_ns.reserve(config.iterations);
+  start = std::chrono::steady_clock::now();
+  t_start = sim::now_us();
+
+  for (i = 0; i < config.iterations; i++)
+  {
+    if (modio)
+    {
+      if (config.toggle && sim::now_us() - t_start >= (uint64_t)toggles * config.toggle)
+      {
+        toggle_inputs(toggles);
+        toggle_us = (uint32_t)sim::now_us();
+        toggles++;
+        bounces = 0;
+      }
+      // chatter at a third and two thirds of the bounce time
+      if (config.bounce && toggles && bounces < 2
+          && sim::now_us() - t_start >= (uint64_t)(toggles - 1) * config.toggle + (bounces + 1) * config.bounce / 3)
+      {
+        toggle_inputs(toggles - 1);
+        bounces++;
+      }
+      if (config.write_every && config.boards && sim::now_us() - t_start >= (uint64_t)writes * config.write_every)
+      {
+        j = writes % config.boards;
+        if (config.pulse)
+          send_pulse(j % 3, 0x20 + j / 3, stats);
+        for (k = 0; !config.pulse && k < config.write_burst; k++)
+          send_modio(ModIOCmd::write_dig, j % 3, 0x20 + j / 3, (writes + k) & 0x0F, stats);
+        writes++;
+      }
+      if (config.stuck_every && config.boards && sim::now_us() - t_start >= (uint64_t)(stucks + 1) * config.stuck_every)
+      {
+        j = stucks % config.boards;
+        ports[j % 3]->sim_find(0x20 + j / 3)->stuck = true;
+        stucks++;
+      }
+      if (config.read_every && config.boards && sim::now_us() - t_start >= (uint64_t)reads * config.read_every)
+      {
+        j = reads % config.boards;
+        send_modio(ModIOCmd::read_dig, j % 3, 0x20 + j / 3, 0, stats);
+        reads++;
+      }
+    }
+    else
+    {
+      for (j = 0; j < config.rate; j++)
+        send_echo(stats);
+    }
+
+    t0 = std::chrono::steady_clock::now();
+    loop();
+    t1 = std::chrono::steady_clock::now();
+    loop_ns.push_back((uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count());
+
+    for (j = 0; config.trigger && j < config.boards && j < TRIGGER_RULES_N; j++)
+    {
+      dev = ports[j % 3]->sim_find(0x20 + j / 3);
+      if (dev->relays_us != relays_seen[j])
+      {
+        stats.reaction_us.push_back(dev->relays_us - toggle_us);
+        relays_seen[j] = dev->relays_us;
+      }
+    }
+
+    if (config.stall && sim::now_us() - t_start >= config.stall && sim::now_us() - t_start < 2 * (uint64_t)config.stall)
+      continue;
+    if (sim::now_us() - t_start >= (uint64_t)drains * config.drain_every)
+    {
+      drain_host(stats);
+      if (config.journal)
+        request_dump(stats);
+      drains++;
+    }
+  }
+  drain_host(stats);
+
+  elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::sort(loop_ns.begin(), loop_ns.end());
+  pushes = stats.telemetry_host.size();
+  for (i = 0; i < 3; i++)
+  {
+    stuck_count += ports[i]->sim_stuck_count();
+    stuck_us += ports[i]->sim_stuck_us();
+    still_stuck |= ports[i]->sim_stuck();
+  }
+  // before the loops below, so the profile covers just the run
+  read_profile(false, profile);
+
+  // let the dumps catch up with the events that were missed by the end
+  if (config.journal)
+  {
+    for (i = 0; i < 1000000 && (stats.journal_dumping || stats.journal_gap); i++)
+    {
+      loop();
+      drain_host(stats);
+      request_dump(stats);
+    }
+    journal_end = stats.journal_seen.size();
+    journal_lost = journal_missing(stats, 0, journal_end, &first_missing, &last_missing);
+  }
+
+  if (modio)
+  {
+    teardown = BenchStats();
+    for (i = 0; i < config.boards; i++)
+    {
+      send_modio(ModIOCmd::poll_stats, i % 3, 0x20 + i / 3, 0, teardown);
+      send_modio(ModIOCmd::queue_stats, i % 3, 0x20 + i / 3, 0, teardown);
+      send_telemetry(TelemetryCmd::board, i % 3, 0x20 + i / 3, 0, teardown);
+    }
+    send_telemetry(TelemetryCmd::host, 0, 0, 0, teardown);
+    if (config.telemetry)
+      send_telemetry(TelemetryCmd::push, 0, 0, 0, teardown);
+    loop();
+    drain_host(teardown);
+    for (const ModIODataPollStats& board : teardown.poll_stats)
+    {
+      polls += board.polls;
+      missed += board.missed;
+      max_late = std::max(max_late, board.max_late_us);
+      poll_rate += board.active_us ? board.polls * 1e6 / board.active_us : 0;
+    }
+    for (const ModIODataQueueStats& board : teardown.queue_stats)
+    {
+      for (j = 0; j < MODIO_LANES_N; j++)
+      {
+        lane_requests[j] += board.lanes[j].requests;
+        lane_wait[j] += (double)board.lanes[j].mean_us * board.lanes[j].requests;
+        lane_max_wait[j] = std::max(lane_max_wait[j], board.lanes[j].max_us);
+      }
+    }
+    if (!teardown.telemetry_host.empty())
+      device = teardown.telemetry_host.back();
+    for (const TelemetryDataBoardStats& board : teardown.telemetry_boards)
+    {
+      board_transactions += board.transactions;
+      board_errors += board.errors;
+      board_timeouts += board.timeouts;
+      for (j = 0; j < MODIO_LANES_N; j++)
+        queue_max[j] = std::max(queue_max[j], board.lanes[j].max);
+      for (j = 0; j < MODIO_LATENCY_BINS_N; j++)
+        latency[j] += board.latency[j];
+    }
+
+    // every board must be found and removed without errors, so drop the writes still scheduled
+    teardown = BenchStats();
+    if (config.schedule_ahead)
+    {
+      cancel.header.code = HostCode::scheduled;
+      cancel.at_us = 0;
+      send_frame(&cancel, sizeof(HostDataScheduled), teardown);
+    }
+    for (i = 0; i < config.boards; i++)
+      send_modio(ModIOCmd::remove, i % 3, 0x20 + i / 3, 0, teardown);
+    for (i = 0; i < 1000; i++)
+    {
+      loop();
+      drain_host(teardown);
+    }
+  }
+
+  printf("scenario: %s, iterations: %u, boards: %u, i2c latency: %u us\n",
+         config.scenario, config.iterations, modio ? config.boards : 0, config.latency_us);
+  printf("elapsed: %.3f s\n", elapsed);
+  printf("frames in: %llu (%.0f/s), frames out: %llu (%.0f/s)\n",
+         (unsigned long long)stats.frames_in, stats.frames_in / elapsed,
+         (unsigned long long)stats.frames_out, stats.frames_out / elapsed);
+  printf("errors: %llu, dropped: %llu, coalesced: %llu\n", (unsigned long long)stats.errors,
+         (unsigned long long)stats.dropped, (unsigned long long)stats.coalesced);
+  if (config.corrupt_every)
+    printf("corrupted frames: %llu, resyncs: %llu, other errors: %llu\n", (unsigned long long)stats.corrupted,
+           (unsigned long long)stats.resyncs, (unsigned long long)(stats.errors - stats.resyncs));
+  if (config.edges)
+    printf("input toggles: %llu, edges reported: %llu\n", (unsigned long long)toggles * config.boards,
+           (unsigned long long)stats.edges);
+  printf("serial writes: %llu, bytes out: %llu, bytes in: %llu\n",
+         (unsigned long long)sim::serial_write_calls(), (unsigned long long)sim::serial_bytes_written(),
+         (unsigned long long)sim::serial_bytes_read());
+  printf("loop() ns: p50 %.0f, p90 %.0f, p99 %.0f, p99.9 %.0f, max %u\n",
+         percentile(loop_ns, 50), percentile(loop_ns, 90), percentile(loop_ns, 99), percentile(loop_ns, 99.9),
+         loop_ns.back());
+  printf("board pool: %zu bytes per board at the default depths, %zu bytes for %u boards and %u queue entries\n",
+         ModIOBoard::bytes_per_board(), ModIOBoard::pool_bytes(), NUM_MODIO_BOARDS_MAX, I2C_REQUEST_POOL_N);
+  if (!stats.transaction_us.empty())
+  {
+    std::sort(stats.transaction_us.begin(), stats.transaction_us.end());
+    printf("device transaction us: p50 %.0f, p99 %.0f, max %u\n", percentile(stats.transaction_us, 50),
+           percentile(stats.transaction_us, 99), stats.transaction_us.back());
+  }
+  if (config.journal)
+    printf("journal events: %zu, missed live: %zu, lost: %zu\n", journal_end, stats.journal_missed, journal_lost);
+  if (config.trigger)
+    printf("trigger rules fired: %llu\n", (unsigned long long)stats.fired);
+  if (!stats.reaction_us.empty())
+  {
+    std::sort(stats.reaction_us.begin(), stats.reaction_us.end());
+    printf("trigger reaction us, input change to relay written: p50 %.0f, p99 %.0f, max %u\n",
+           percentile(stats.reaction_us, 50), percentile(stats.reaction_us, 99), stats.reaction_us.back());
+  }
+  if (!stats.scheduled_late_us.empty())
+  {
+    std::sort(stats.scheduled_late_us.begin(), stats.scheduled_late_us.end());
+    printf("scheduled frames: %zu, late us: p50 %.0f, p99 %.0f, max %u\n", stats.scheduled_late_us.size(),
+           percentile(stats.scheduled_late_us, 50), percentile(stats.scheduled_late_us, 99),
+           stats.scheduled_late_us.back());
+  }
+  if (!stats.pulse_error_us.empty())
+  {
+    std::sort(stats.pulse_error_us.begin(), stats.pulse_error_us.end());
+    printf("pulse trains: %zu, end error us: p50 %.0f, p99 %.0f, max %u\n", stats.pulse_error_us.size(),
+           percentile(stats.pulse_error_us, 50), percentile(stats.pulse_error_us, 99), stats.pulse_error_us.back());
+  }
+  if (modio)
+    printf("polls: %llu, %.0f/s per board, missed deadlines: %llu, max late: %u us\n", (unsigned long long)polls,
+           config.boards ? poll_rate / config.boards : 0, (unsigned long long)missed, max_late);
+  if (modio)
+  {
+    printf("queue wait us: urgent %llu requests, mean %.0f, max %u; normal %llu requests, mean %.0f, max %u\n",
+           (unsigned long long)lane_requests[MODIO_LANE_URGENT],
+           lane_requests[MODIO_LANE_URGENT] ? lane_wait[MODIO_LANE_URGENT] / lane_requests[MODIO_LANE_URGENT] : 0,
+           lane_max_wait[MODIO_LANE_URGENT], (unsigned long long)lane_requests[MODIO_LANE_NORMAL],
+           lane_requests[MODIO_LANE_NORMAL] ? lane_wait[MODIO_LANE_NORMAL] / lane_requests[MODIO_LANE_NORMAL] : 0,
+           lane_max_wait[MODIO_LANE_NORMAL]);
+  }
+  if (modio)
+  {
+    printf("device telemetry: loops %u, loop mean %u ns, max %u us, bytes in %u, out %u, tx max held %u, "
+           "dropped %u, pushes %zu\n", device.loops, device.loop_mean_ns, device.loop_max_us, device.bytes_in,
+           device.bytes_out, device.tx_max_held, device.dropped_msgs, pushes);
+    printf("device boards: transactions %llu, errors %llu, timeouts %llu, queue max urgent %u, normal %u\n",
+           (unsigned long long)board_transactions, (unsigned long long)board_errors,
+           (unsigned long long)board_timeouts, queue_max[MODIO_LANE_URGENT], queue_max[MODIO_LANE_NORMAL]);
+    printf("device transaction us histogram:");
+    for (j = 0; j < MODIO_LATENCY_BINS_N; j++)
+      printf(" %s%u: %llu", j ? ">=" : "<", j ? 64 << j : 128, (unsigned long long)latency[j]);
+    printf("\n");
+  }
+  if (config.stuck_every)
+  {
+    printf("stuck buses: %u, held for mean %.0f us, still stuck at the end: %s\n", stuck_count,
+           stuck_count ? (double)stuck_us / stuck_count : 0, still_stuck ? "yes" : "no");
+    printf("health reports: ok %llu, failing %llu, failed %llu\n",
+           (unsigned long long)stats.health[(uint8_t)ModIOHealth::ok],
+           (unsigned long long)stats.health[(uint8_t)ModIOHealth::failing],
+           (unsigned long long)stats.health[(uint8_t)ModIOHealth::failed]);
+  }
+  if (modio)
+    printf("teardown frames: %llu, errors: %llu, requests answered by the removes: %llu\n",
+           (unsigned long long)teardown.frames_in, (unsigned long long)teardown.errors,
+           (unsigned long long)teardown.removed);
+  print_profile(profile);
+  for (i = 0; i < 3; i++)
+  {
+    printf("port %u: transactions %u, overlapped %u, busy %.1f%%\n", i, ports[i]->sim_transactions(),
+           ports[i]->sim_overlapped(), 100. * ports[i]->sim_busy_us() / (elapsed * 1e6));
+  }
+
+  return 0;
+}
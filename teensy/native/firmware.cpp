@@ -0,0 +1,2 @@
+// builds the sketch as a normal translation unit, so setup() and loop() can be driven by the benchmark
+#include "../lickauto/lickauto.ino"
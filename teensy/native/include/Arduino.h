@@ -0,0 +1,80 @@
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+// Host-native stand-in for the parts of the Teensyduino core used by the firmware.
+// Implemented on top of the simulated clock and pins in ../sim.cpp
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "IntervalTimer.h"
+
+
+#define LOW 0
+#define HIGH 1
+
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define OUTPUT_OPENDRAIN 4
+
+#define LED_BUILTIN 13
+#define NUM_DIGITAL_PINS 55
+
+
+uint32_t micros();
+uint32_t millis();
+void delayMicroseconds(uint32_t usec);
+
+// the cycle counter runs on the host monotonic clock at F_CPU, even with the virtual clock, so profiling
+// measures what the firmware code really costs on the host
+#define F_CPU 600000000
+uint32_t sim_cycles();
+#define ARM_DWT_CYCCNT (sim_cycles())
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+uint8_t digitalRead(uint8_t pin);
+
+inline void digitalWriteFast(uint8_t pin, uint8_t val) { digitalWrite(pin, val); }
+
+// GPIO set and clear registers, pin n is bit n / 4 of port n % 4. Writing a mask sets or clears all
+// those pins of the port right away, like the DR_SET and DR_CLEAR registers
+#define SIM_GPIO_PORTS_N 4
+
+struct SimGpioReg
+{
+  uint8_t port;
+  uint8_t level;
+
+  void operator=(uint32_t mask);
+};
+
+extern SimGpioReg sim_gpio_set[SIM_GPIO_PORTS_N];
+extern SimGpioReg sim_gpio_clear[SIM_GPIO_PORTS_N];
+
+#define digitalPinToBitMask(pin) ((uint32_t)1 << ((pin) / SIM_GPIO_PORTS_N))
+#define portSetRegister(pin) (&sim_gpio_set[(pin) % SIM_GPIO_PORTS_N])
+#define portClearRegister(pin) (&sim_gpio_clear[(pin) % SIM_GPIO_PORTS_N])
+
+void noInterrupts();
+void interrupts();
+
+
+class usb_serial_class
+{
+  public:
+    int available();
+    int read();
+    size_t readBytes(char* buffer, size_t length);
+    int availableForWrite();
+    size_t write(const uint8_t* buffer, size_t size);
+    size_t write(uint8_t c) { return write(&c, 1); }
+    void flush() {}
+};
+
+extern usb_serial_class Serial;
+
+#endif
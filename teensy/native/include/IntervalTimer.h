@@ -0,0 +1,27 @@
+#ifndef SIM_INTERVAL_TIMER_H
+#define SIM_INTERVAL_TIMER_H
+
+// Host-native stand-in for the Teensy IntervalTimer. Callbacks run like interrupts on the simulated
+// clock, see sim::advance_us, and are held off between noInterrupts() and interrupts().
+
+#include <stdint.h>
+
+#define SIM_INTERVAL_TIMERS_MAX 4
+
+
+class IntervalTimer
+{
+  public:
+    IntervalTimer() {}
+    ~IntervalTimer() { end(); }
+
+    bool begin(void (*funct)(), unsigned int microseconds);
+    void update(unsigned int microseconds);
+    void end();
+    void priority(uint8_t n) {}
+
+  private:
+    int _slot = -1;
+};
+
+#endif
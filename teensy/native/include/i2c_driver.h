@@ -0,0 +1,53 @@
+#ifndef SIM_I2C_DRIVER_H
+#define SIM_I2C_DRIVER_H
+
+// Host-native stand-in for https://github.com/Richard-Gemmell/teensy4_i2c/blob/v2.0.0-beta.2/src/i2c_driver.h
+// Only the master side used by the firmware is provided.
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+enum class I2CError {
+  ok = 0,
+  arbitration_lost,
+  buffer_overflow,
+  buffer_underflow,
+  invalid_request,
+  master_pin_low_timeout,
+  master_not_ready,
+  master_fifo_error,
+  master_fifos_not_empty,
+  address_nak,
+  data_nak,
+  bit_error,
+};
+
+
+enum class InternalPullup {
+  disabled,
+  enabled_22k_ohm,
+  enabled_47k_ohm,
+  enabled_100k_ohm,
+};
+
+
+class I2CMaster
+{
+  public:
+    virtual ~I2CMaster() = default;
+
+    virtual void begin(uint32_t frequency) = 0;
+    virtual void end() = 0;
+    virtual bool finished() = 0;
+    virtual size_t get_bytes_transferred() = 0;
+    virtual I2CError error() = 0;
+    inline bool has_error() { return error() != I2CError::ok; }
+
+    virtual void write_async(uint16_t address, const uint8_t* buffer, size_t num_bytes, bool send_stop) = 0;
+    virtual void read_async(uint16_t address, uint8_t* buffer, size_t num_bytes, bool send_stop) = 0;
+
+    virtual void set_internal_pullups(InternalPullup pullup) = 0;
+};
+
+#endif
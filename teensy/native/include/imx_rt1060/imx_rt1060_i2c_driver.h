@@ -0,0 +1,108 @@
+#ifndef SIM_IMX_RT1060_I2C_DRIVER_H
+#define SIM_IMX_RT1060_I2C_DRIVER_H
+
+// Host-native stand-in for the Teensy 4 I2C masters. Each port is an emulated bus with Olimex MOD-IO
+// boards attached to it. Transactions complete after the time it takes to clock the bytes out at the
+// configured frequency plus a configurable per-transaction latency, measured on the simulated clock.
+
+#include "../i2c_driver.h"
+
+#define SIM_I2C_DEVICES_MAX 32
+
+
+// emulates the MOD-IO register protocol, 0x10 write relays, 0x20 read inputs, 0xF0 change address
+struct SimModIO
+{
+  uint8_t address;
+  uint8_t relays;
+  // when the last relay write finished on the bus
+  uint32_t relays_us;
+  uint8_t inputs;
+  uint8_t command;
+  bool present;
+  // the next transaction addressed to it is cut off mid-byte and it holds SDA low, so nothing on the bus
+  // completes until SCL is clocked by hand
+  bool stuck;
+  // a PCF8574 port instead, relays on P0-P3 and inputs on P4-P7
+  bool pcf8574;
+};
+
+
+class IMX_RT1060_I2CMaster : public I2CMaster
+{
+  public:
+    explicit IMX_RT1060_I2CMaster(uint8_t port);
+
+    void begin(uint32_t frequency) override;
+    void end() override;
+    bool finished() override;
+    size_t get_bytes_transferred() override;
+    I2CError error() override;
+
+    void write_async(uint16_t address, const uint8_t* buffer, size_t num_bytes, bool send_stop) override;
+    void read_async(uint16_t address, uint8_t* buffer, size_t num_bytes, bool send_stop) override;
+
+    void set_internal_pullups(InternalPullup pullup) override;
+
+    // simulation controls
+    void sim_reset();
+    void sim_set_latency(uint32_t latency_us);
+    SimModIO* sim_add_modio(uint8_t address);
+    SimModIO* sim_find(uint8_t address);
+
+    uint32_t sim_frequency() { return _frequency; }
+    uint32_t sim_begin_count() { return _begin_count; }
+    uint32_t sim_transactions() { return _transactions; }
+    uint32_t sim_overlapped() { return _overlapped; }
+    uint64_t sim_busy_us() { return _busy_us; }
+    uint32_t sim_stuck_count() { return _stuck_count; }
+    // time SDA was held low, up to now if it still is
+    uint64_t sim_stuck_us();
+    bool sim_stuck() { return _sda_low; }
+
+  private:
+    void start(uint16_t address, size_t num_bytes, bool send_stop);
+    void complete();
+
+    uint8_t _port;
+    uint32_t _frequency;
+    bool _begun;
+    InternalPullup _pullup;
+    uint32_t _latency_us;
+
+    bool _busy;
+    bool _reading;
+    bool _send_stop;
+    // the last transaction ended without a stop, so the next one begins with a repeated start
+    bool _held;
+    uint16_t _address;
+    const uint8_t* _write_buff;
+    uint8_t* _read_buff;
+    size_t _num_bytes;
+    size_t _transferred;
+    uint32_t _start_us;
+    uint32_t _duration_us;
+    I2CError _error;
+
+    // a stuck device holds SDA low, from _sda_low_us and SCL having toggled _scl_toggles times
+    bool _sda_low;
+    uint32_t _sda_low_us;
+    uint64_t _scl_toggles;
+    uint32_t _stuck_count;
+    uint64_t _stuck_us;
+
+    SimModIO _devices[SIM_I2C_DEVICES_MAX];
+    uint8_t _devices_n;
+
+    uint32_t _begin_count;
+    uint32_t _transactions;
+    uint32_t _overlapped;
+    uint64_t _busy_us;
+};
+
+
+extern IMX_RT1060_I2CMaster Master;
+extern IMX_RT1060_I2CMaster Master1;
+extern IMX_RT1060_I2CMaster Master2;
+
+#endif
@@ -0,0 +1,380 @@
+#include "Arduino.h"
+#include "imx_rt1060/imx_rt1060_i2c_driver.h"
+#include "sim.h"
+
+#include <chrono>
+#include <deque>
+#include <vector>
+
+
+usb_serial_class Serial;
+SimGpioReg sim_gpio_set[SIM_GPIO_PORTS_N] = {{0, HIGH}, {1, HIGH}, {2, HIGH}, {3, HIGH}};
+SimGpioReg sim_gpio_clear[SIM_GPIO_PORTS_N] = {{0, LOW}, {1, LOW}, {2, LOW}, {3, LOW}};
+
+
+static bool virtual_clock = false;
+static uint64_t virtual_us = 0;
+static const std::chrono::steady_clock::time_point clock_start = std::chrono::steady_clock::now();
+
+static std::deque<uint8_t> rx_buff;
+static std::vector<uint8_t> tx_buff;
+static size_t tx_capacity = 4096;
+static uint64_t write_calls = 0;
+static uint64_t bytes_written = 0;
+static uint64_t bytes_read = 0;
+
+static uint8_t pin_levels[NUM_DIGITAL_PINS] = {0};
+static uint8_t pin_modes[NUM_DIGITAL_PINS] = {0};
+static uint64_t pin_toggle_count[NUM_DIGITAL_PINS] = {0};
+static bool pin_driven[NUM_DIGITAL_PINS] = {false};
+static uint8_t pin_driven_levels[NUM_DIGITAL_PINS] = {0};
+static bool tracing = false;
+static std::vector<sim::PinEvent> trace;
+
+
+struct SimTimer
+{
+  bool active;
+  void (*funct)();
+  uint32_t period_us;
+  uint64_t next_us;
+};
+
+static SimTimer timers[SIM_INTERVAL_TIMERS_MAX] = {};
+static bool interrupts_enabled = true;
+static bool in_isr = false;
+
+
+// runs the timer callbacks that are due by the given time in deadline order, like interrupts would
+static void run_timers(uint64_t until)
+{
+  SimTimer* timer;
+  int i;
+
+  if (in_isr || !interrupts_enabled)
+    return;
+
+  in_isr = true;
+  while (true)
+  {
+    timer = NULL;
+    for (i = 0; i < SIM_INTERVAL_TIMERS_MAX; i++)
+    {
+      if (timers[i].active && timers[i].next_us <= until && (timer == NULL || timers[i].next_us < timer->next_us))
+        timer = &timers[i];
+    }
+    if (timer == NULL)
+      break;
+
+    // the virtual clock reads exactly the deadline inside the callback
+    if (virtual_clock && timer->next_us > virtual_us)
+      virtual_us = timer->next_us;
+    timer->next_us += timer->period_us;
+    timer->funct();
+  }
+  in_isr = false;
+}
+
+
+void sim::use_virtual_clock(bool enable)
+{
+  if (enable && !virtual_clock)
+    virtual_us = now_us();
+  virtual_clock = enable;
+}
+
+void sim::advance_us(uint32_t us)
+{
+  uint64_t end = virtual_us + us;
+
+  run_timers(end);
+  virtual_us = end;
+}
+
+uint64_t sim::now_us()
+{
+  if (virtual_clock)
+    return virtual_us;
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - clock_start).count();
+}
+
+void sim::host_write(const void* data, size_t len)
+{
+  rx_buff.insert(rx_buff.end(), (const uint8_t*)data, (const uint8_t*)data + len);
+}
+
+size_t sim::host_read(uint8_t* data, size_t len)
+{
+  if (len > tx_buff.size())
+    len = tx_buff.size();
+
+  memcpy(data, tx_buff.data(), len);
+  tx_buff.erase(tx_buff.begin(), tx_buff.begin() + len);
+  return len;
+}
+
+size_t sim::host_pending()
+{
+  return tx_buff.size();
+}
+
+void sim::set_serial_tx_capacity(size_t capacity)
+{
+  tx_capacity = capacity;
+}
+
+uint64_t sim::serial_write_calls()
+{
+  return write_calls;
+}
+
+uint64_t sim::serial_bytes_written()
+{
+  return bytes_written;
+}
+
+uint64_t sim::serial_bytes_read()
+{
+  return bytes_read;
+}
+
+void sim::trace_pins(bool enable)
+{
+  tracing = enable;
+}
+
+const sim::PinEvent* sim::pin_trace(size_t* n)
+{
+  *n = trace.size();
+  return trace.data();
+}
+
+void sim::clear_pin_trace()
+{
+  trace.clear();
+}
+
+uint8_t sim::pin_level(uint8_t pin)
+{
+  return pin < NUM_DIGITAL_PINS ? pin_levels[pin] : 0;
+}
+
+uint8_t sim::pin_mode(uint8_t pin)
+{
+  return pin < NUM_DIGITAL_PINS ? pin_modes[pin] : 0;
+}
+
+uint64_t sim::pin_toggles(uint8_t pin)
+{
+  return pin < NUM_DIGITAL_PINS ? pin_toggle_count[pin] : 0;
+}
+
+void sim::reset()
+{
+  rx_buff.clear();
+  tx_buff.clear();
+  write_calls = 0;
+  bytes_written = 0;
+  bytes_read = 0;
+
+  memset(pin_levels, 0, sizeof(pin_levels));
+  memset(pin_modes, 0, sizeof(pin_modes));
+  memset(pin_toggle_count, 0, sizeof(pin_toggle_count));
+  memset(pin_driven, 0, sizeof(pin_driven));
+  trace.clear();
+  tracing = false;
+
+  memset(timers, 0, sizeof(timers));
+  interrupts_enabled = true;
+
+  Master.sim_reset();
+  Master1.sim_reset();
+  Master2.sim_reset();
+}
+
+
+uint32_t micros()
+{
+  uint64_t now = sim::now_us();
+
+  // with the host clock, timers preempt the firmware whenever it looks at the time
+  if (!virtual_clock)
+    run_timers(now);
+  return (uint32_t)now;
+}
+
+uint32_t millis()
+{
+  return micros() / 1000;
+}
+
+uint32_t sim_cycles()
+{
+  return (uint32_t)(std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - clock_start).count() * (F_CPU / 1000000) / 1000);
+}
+
+void delayMicroseconds(uint32_t usec)
+{
+  uint64_t end = sim::now_us() + usec;
+
+  if (virtual_clock)
+  {
+    sim::advance_us(usec);
+    return;
+  }
+  while (sim::now_us() < end)
+    run_timers(sim::now_us());
+}
+
+void noInterrupts()
+{
+  interrupts_enabled = false;
+}
+
+void interrupts()
+{
+  interrupts_enabled = true;
+  run_timers(sim::now_us());
+}
+
+bool IntervalTimer::begin(void (*funct)(), unsigned int microseconds)
+{
+  int i = 0;
+
+  if (_slot < 0)
+  {
+    for (; i < SIM_INTERVAL_TIMERS_MAX && timers[i].active; i++);
+    if (i == SIM_INTERVAL_TIMERS_MAX)
+      return false;
+    _slot = i;
+  }
+
+  timers[_slot].funct = funct;
+  timers[_slot].period_us = microseconds;
+  timers[_slot].next_us = sim::now_us() + microseconds;
+  timers[_slot].active = true;
+  return true;
+}
+
+void IntervalTimer::update(unsigned int microseconds)
+{
+  if (_slot >= 0)
+    timers[_slot].period_us = microseconds;
+}
+
+void IntervalTimer::end()
+{
+  if (_slot < 0)
+    return;
+
+  timers[_slot].active = false;
+  _slot = -1;
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  if (pin < NUM_DIGITAL_PINS)
+    pin_modes[pin] = mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+  if (pin >= NUM_DIGITAL_PINS)
+    return;
+
+  val = val ? HIGH : LOW;
+  if (pin_levels[pin] != val)
+  {
+    pin_toggle_count[pin]++;
+    if (tracing)
+      trace.push_back({sim::now_us(), pin, val});
+  }
+  pin_levels[pin] = val;
+}
+
+void SimGpioReg::operator=(uint32_t mask)
+{
+  uint8_t bit = 0;
+
+  for (; mask; bit++, mask >>= 1)
+  {
+    if (mask & 1)
+      digitalWrite(bit * SIM_GPIO_PORTS_N + port, level);
+  }
+}
+
+uint8_t digitalRead(uint8_t pin)
+{
+  if (pin >= NUM_DIGITAL_PINS)
+    return LOW;
+  if (pin_driven[pin] && pin_modes[pin] != OUTPUT)
+    return pin_driven_levels[pin];
+  return pin_levels[pin];
+}
+
+void sim::drive_pin(uint8_t pin, uint8_t level)
+{
+  if (pin >= NUM_DIGITAL_PINS)
+    return;
+  pin_driven[pin] = true;
+  pin_driven_levels[pin] = level ? HIGH : LOW;
+}
+
+void sim::release_pin(uint8_t pin)
+{
+  if (pin < NUM_DIGITAL_PINS)
+    pin_driven[pin] = false;
+}
+
+
+int usb_serial_class::available()
+{
+  return (int)rx_buff.size();
+}
+
+int usb_serial_class::read()
+{
+  int item;
+
+  if (rx_buff.empty())
+    return -1;
+
+  item = rx_buff.front();
+  rx_buff.pop_front();
+  bytes_read++;
+  return item;
+}
+
+size_t usb_serial_class::readBytes(char* buffer, size_t length)
+{
+  size_t i = 0;
+
+  for (; i < length && !rx_buff.empty(); i++)
+  {
+    buffer[i] = (char)rx_buff.front();
+    rx_buff.pop_front();
+  }
+
+  bytes_read += i;
+  return i;
+}
+
+int usb_serial_class::availableForWrite()
+{
+  return tx_buff.size() >= tx_capacity ? 0 : (int)(tx_capacity - tx_buff.size());
+}
+
+size_t usb_serial_class::write(const uint8_t* buffer, size_t size)
+{
+  size_t space = (size_t)availableForWrite();
+
+  if (size > space)
+    size = space;
+
+  tx_buff.insert(tx_buff.end(), buffer, buffer + size);
+  write_calls++;
+  bytes_written += size;
+  return size;
+}
@@ -0,0 +1,54 @@
+#ifndef SIM_H
+#define SIM_H
+
+// Controls for the host-native simulation of the Teensy backend used by the benchmark.
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+namespace sim
+{
+  // the clock is either the host monotonic clock or a virtual clock that only moves with advance_us.
+  // Interval timers fire at their exact deadlines while advancing the virtual clock, or when the time
+  // is read with the host clock
+  void use_virtual_clock(bool enable);
+  void advance_us(uint32_t us);
+  uint64_t now_us();
+
+  // host side of the USB serial link. Bytes written by the firmware stay in the device TX buffer,
+  // reducing availableForWrite, until the host reads them
+  void host_write(const void* data, size_t len);
+  size_t host_read(uint8_t* data, size_t len);
+  size_t host_pending();
+  void set_serial_tx_capacity(size_t capacity);
+
+  uint64_t serial_write_calls();
+  uint64_t serial_bytes_written();
+  uint64_t serial_bytes_read();
+
+  // level changes of the pins written by the firmware, recorded while tracing is enabled
+  struct PinEvent
+  {
+    uint64_t time_us;
+    uint8_t pin;
+    uint8_t level;
+  };
+
+  void trace_pins(bool enable);
+  const PinEvent* pin_trace(size_t* n);
+  void clear_pin_trace();
+
+  // another device drives an input pin, so digitalRead sees this level until it's released
+  void drive_pin(uint8_t pin, uint8_t level);
+  void release_pin(uint8_t pin);
+
+  uint8_t pin_level(uint8_t pin);
+  uint8_t pin_mode(uint8_t pin);
+  uint64_t pin_toggles(uint8_t pin);
+
+  // resets serial, pins and all the I2C ports
+  void reset();
+}
+
+#endif
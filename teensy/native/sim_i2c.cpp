@@ -0,0 +1,256 @@
+#include "Arduino.h"
+#include "imx_rt1060/imx_rt1060_i2c_driver.h"
+#include "sim.h"
+
+
+IMX_RT1060_I2CMaster Master(0);
+IMX_RT1060_I2CMaster Master1(1);
+IMX_RT1060_I2CMaster Master2(2);
+
+// the Teensy 4 pins of each port
+static const uint8_t scl_pins[] = {19, 16, 24};
+static const uint8_t sda_pins[] = {18, 17, 25};
+
+
+IMX_RT1060_I2CMaster::IMX_RT1060_I2CMaster(uint8_t port)
+{
+  _port = port;
+  sim_reset();
+}
+
+void IMX_RT1060_I2CMaster::sim_reset()
+{
+  _frequency = 0;
+  _begun = false;
+  _pullup = InternalPullup::disabled;
+  _latency_us = 0;
+
+  _busy = false;
+  _reading = false;
+  _send_stop = true;
+  _held = false;
+  _address = 0;
+  _write_buff = NULL;
+  _read_buff = NULL;
+  _num_bytes = 0;
+  _transferred = 0;
+  _start_us = 0;
+  _duration_us = 0;
+  _error = I2CError::ok;
+
+  _sda_low = false;
+  _sda_low_us = 0;
+  _scl_toggles = 0;
+  _stuck_count = 0;
+  _stuck_us = 0;
+
+  _devices_n = 0;
+
+  _begin_count = 0;
+  _transactions = 0;
+  _overlapped = 0;
+  _busy_us = 0;
+}
+
+void IMX_RT1060_I2CMaster::sim_set_latency(uint32_t latency_us)
+{
+  _latency_us = latency_us;
+}
+
+SimModIO* IMX_RT1060_I2CMaster::sim_add_modio(uint8_t address)
+{
+  SimModIO* dev = sim_find(address);
+
+  if (dev != NULL)
+    return dev;
+  if (_devices_n == SIM_I2C_DEVICES_MAX)
+    return NULL;
+
+  dev = &_devices[_devices_n++];
+  dev->address = address;
+  dev->relays = 0;
+  dev->relays_us = 0;
+  dev->inputs = 0;
+  dev->command = 0;
+  dev->present = true;
+  dev->stuck = false;
+  dev->pcf8574 = false;
+  return dev;
+}
+
+SimModIO* IMX_RT1060_I2CMaster::sim_find(uint8_t address)
+{
+  uint8_t i = 0;
+
+  for (; i < _devices_n; i++)
+  {
+    if (_devices[i].present && _devices[i].address == address)
+      return &_devices[i];
+  }
+  return NULL;
+}
+
+uint64_t IMX_RT1060_I2CMaster::sim_stuck_us()
+{
+  return _stuck_us + (_sda_low ? micros() - _sda_low_us : 0);
+}
+
+void IMX_RT1060_I2CMaster::begin(uint32_t frequency)
+{
+  // restarting the controller alone doesn't free SDA, the device lets go once SCL was clocked
+  if (_sda_low && sim::pin_toggles(scl_pins[_port]) >= _scl_toggles + 2)
+  {
+    _sda_low = false;
+    _stuck_us += micros() - _sda_low_us;
+    sim::release_pin(sda_pins[_port]);
+  }
+
+  _frequency = frequency;
+  _begun = true;
+  _busy = false;
+  _held = false;
+  _error = I2CError::ok;
+  _begin_count++;
+}
+
+void IMX_RT1060_I2CMaster::end()
+{
+  _begun = false;
+  _busy = false;
+  _held = false;
+}
+
+bool IMX_RT1060_I2CMaster::finished()
+{
+  if (_busy && micros() - _start_us >= _duration_us)
+    complete();
+  return !_busy;
+}
+
+size_t IMX_RT1060_I2CMaster::get_bytes_transferred()
+{
+  return _transferred;
+}
+
+I2CError IMX_RT1060_I2CMaster::error()
+{
+  return _error;
+}
+
+void IMX_RT1060_I2CMaster::set_internal_pullups(InternalPullup pullup)
+{
+  _pullup = pullup;
+}
+
+void IMX_RT1060_I2CMaster::write_async(uint16_t address, const uint8_t* buffer, size_t num_bytes, bool send_stop)
+{
+  _write_buff = buffer;
+  _reading = false;
+  start(address, num_bytes, send_stop);
+}
+
+void IMX_RT1060_I2CMaster::read_async(uint16_t address, uint8_t* buffer, size_t num_bytes, bool send_stop)
+{
+  _read_buff = buffer;
+  _reading = true;
+  start(address, num_bytes, send_stop);
+}
+
+void IMX_RT1060_I2CMaster::start(uint16_t address, size_t num_bytes, bool send_stop)
+{
+  uint32_t half_bits;
+  SimModIO* dev;
+
+  if (!_begun)
+  {
+    _error = I2CError::master_not_ready;
+    return;
+  }
+  if (_busy && !finished())
+  {
+    // the real driver rejects a transaction while one is in flight, count it so it's visible
+    _overlapped++;
+    _error = I2CError::master_not_ready;
+    return;
+  }
+
+  // start or repeated start, address byte and data bytes with ack bits, and the stop if requested, in half bits
+  half_bits = 2 * (1 + 9 * (uint32_t)(num_bytes + 1) + (send_stop ? 1 : 0));
+  // after a stop the bus must stay free for tBUF, 4.7, 1.3 and 0.5 us at 100 kHz, 400 kHz and 1 MHz or about
+  // half a bit, before the next start. A repeated start doesn't wait
+  if (!_held)
+    half_bits += 1;
+  _held = !send_stop;
+
+  _address = address;
+  _num_bytes = num_bytes;
+  _send_stop = send_stop;
+  _transferred = 0;
+  _error = I2CError::ok;
+  _busy = true;
+  _start_us = micros();
+  _duration_us = (uint32_t)(((uint64_t)half_bits * 500000 + _frequency - 1) / _frequency) + _latency_us;
+
+  _transactions++;
+  _busy_us += _duration_us;
+
+  dev = sim_find((uint8_t)address);
+  if (dev != NULL && dev->stuck && !_sda_low)
+  {
+    dev->stuck = false;
+    _sda_low = true;
+    _sda_low_us = _start_us;
+    _scl_toggles = sim::pin_toggles(scl_pins[_port]);
+    _stuck_count++;
+    sim::drive_pin(sda_pins[_port], LOW);
+  }
+  // nothing completes while SDA is held low
+  if (_sda_low)
+    _duration_us = UINT32_MAX;
+}
+
+void IMX_RT1060_I2CMaster::complete()
+{
+  SimModIO* dev = sim_find((uint8_t)_address);
+  size_t i = 0;
+
+  _busy = false;
+
+  if (dev == NULL)
+  {
+    _error = I2CError::address_nak;
+    return;
+  }
+
+  if (dev->pcf8574)
+  {
+    if (_reading)
+    {
+      for (; i < _num_bytes; i++)
+        _read_buff[i] = (dev->inputs << 4) | dev->relays;
+    }
+    else if (_num_bytes)
+    {
+      dev->relays = _write_buff[0] & 0x0F;
+      dev->relays_us = _start_us + _duration_us;
+    }
+  }
+  else if (_reading)
+  {
+    for (; i < _num_bytes; i++)
+      _read_buff[i] = dev->command == 0x20 ? dev->inputs : 0xFF;
+  }
+  else if (_num_bytes)
+  {
+    dev->command = _write_buff[0];
+    if (dev->command == 0x10 && _num_bytes >= 2)
+    {
+      dev->relays = _write_buff[1];
+      dev->relays_us = _start_us + _duration_us;
+    }
+    else if (dev->command == 0xF0 && _num_bytes >= 2)
+      dev->address = _write_buff[1];
+  }
+
+  _transferred = _num_bytes;
+}
@@ -0,0 +1,526 @@
+// Checks of the firmware on the host-native build, run by ctest. Each check runs in its own
+// process, since the firmware's state is global.
+//
+// usage: lickauto_test <check>
+
+#include "Arduino.h"
+#include "imx_rt1060/imx_rt1060_i2c_driver.h"
+#include "host_comm.h"
+#include "i2c_board.h"
+#include "marker.h"
+#include "sim.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+
+void setup();
+void loop();
+
+
+static uint8_t next_id = 0;
+
+
+static void send_frame(void* data, uint8_t len)
+{
+  uint8_t sync = HOST_SYNC;
+  uint8_t crc;
+
+  ((HostData*)data)->len = len;
+  ((HostData*)data)->id = next_id++;
+  ((HostData*)data)->err = HostError::no_error;
+  crc = crc8((uint8_t*)data, len);
+  sim::host_write(&sync, 1);
+  sim::host_write(data, len);
+  sim::host_write(&crc, 1);
+}
+
+// runs the loop on the virtual clock until the device sent a frame with the id of the last frame sent, and
+// returns it, or an empty frame if it never came
+static std::vector<uint8_t> reply()
+{
+  uint8_t buff[256];
+  std::vector<uint8_t> pending;
+  std::vector<uint8_t> frame;
+  size_t n;
+  uint32_t i;
+  HostData* header;
+
+  for (i = 0; i < 100000; i++)
+  {
+    loop();
+    sim::advance_us(10);
+    while ((n = sim::host_read(buff, sizeof(buff))) > 0)
+      pending.insert(pending.end(), buff, buff + n);
+
+    while (!pending.empty() && pending[0] && pending[0] <= pending.size())
+    {
+      header = (HostData*)pending.data();
+      if (header->code != HostCode::comm && header->id == (uint8_t)(next_id - 1))
+      {
+        frame.assign(pending.begin(), pending.begin() + header->len);
+        return frame;
+      }
+      pending.erase(pending.begin(), pending.begin() + pending[0]);
+    }
+  }
+  return frame;
+}
+
+// runs the loop on the virtual clock for us, and returns the frames the device sent meanwhile
+static std::vector<std::vector<uint8_t>> run_us(uint32_t us)
+{
+  uint8_t buff[256];
+  std::vector<uint8_t> pending;
+  std::vector<std::vector<uint8_t>> frames;
+  size_t n;
+  uint32_t i = 0;
+
+  for (; i < us / 10; i++)
+  {
+    loop();
+    sim::advance_us(10);
+    while ((n = sim::host_read(buff, sizeof(buff))) > 0)
+      pending.insert(pending.end(), buff, buff + n);
+  }
+
+  while (!pending.empty() && pending[0] && pending[0] <= pending.size())
+  {
+    frames.emplace_back(pending.begin(), pending.begin() + pending[0]);
+    pending.erase(pending.begin(), pending.begin() + pending[0]);
+  }
+  return frames;
+}
+
+static HostError reply_error()
+{
+  std::vector<uint8_t> frame = reply();
+
+  return frame.empty() ? HostError::program_error : ((HostData*)frame.data())->err;
+}
+
+static HostError create(uint8_t port, uint8_t address, uint8_t queue_n, uint8_t urgent_n, uint32_t timeout_us)
+{
+  ModIODataCreate msg;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.header.header.code = HostCode::modio_board;
+  msg.header.port = port;
+  msg.header.address = address;
+  msg.header.cmd = ModIOCmd::create;
+  msg.queue_n = queue_n;
+  msg.urgent_n = urgent_n;
+  msg.timeout_us = timeout_us;
+  send_frame(&msg, sizeof(ModIODataCreate));
+  return reply_error();
+}
+
+static HostError read_dig(uint8_t port, uint8_t address)
+{
+  ModIOData msg;
+
+  msg.header.code = HostCode::modio_board;
+  msg.port = port;
+  msg.address = address;
+  msg.cmd = ModIOCmd::read_dig;
+  send_frame(&msg, sizeof(ModIOData));
+  return reply_error();
+}
+
+static HostError write_mask(uint8_t port, uint8_t address, uint8_t value, uint8_t mask)
+{
+  ModIODataWriteMask msg;
+
+  msg.header.header.header.code = HostCode::modio_board;
+  msg.header.header.port = port;
+  msg.header.header.address = address;
+  msg.header.header.cmd = ModIOCmd::write_dig;
+  msg.header.value = value;
+  msg.mask = mask;
+  send_frame(&msg, sizeof(ModIODataWriteMask));
+  return reply_error();
+}
+
+static HostError pulse(uint8_t port, uint8_t address, uint8_t relays, uint32_t on_us, uint32_t off_us, uint16_t count)
+{
+  ModIODataPulse msg;
+
+  msg.header.header.header.code = HostCode::modio_board;
+  msg.header.header.port = port;
+  msg.header.header.address = address;
+  msg.header.header.cmd = ModIOCmd::write_dig_pulse;
+  msg.header.value = relays;
+  msg.on_us = on_us;
+  msg.off_us = off_us;
+  msg.count = count;
+  send_frame(&msg, sizeof(ModIODataPulse));
+  return reply_error();
+}
+
+static HostError read_cont(uint8_t port, uint8_t address, uint32_t interval_us)
+{
+  ModIODataCont msg;
+
+  msg.header.header.code = HostCode::modio_board;
+  msg.header.port = port;
+  msg.header.address = address;
+  msg.header.cmd = ModIOCmd::read_dig_cont_start;
+  msg.interval_us = interval_us;
+  send_frame(&msg, sizeof(ModIODataCont));
+  return reply_error();
+}
+
+static HostError marker_enable(uint32_t duration)
+{
+  MarkerDataEnable msg;
+
+  msg.header.header.code = HostCode::stream_marker;
+  msg.header.cmd = MarkerCmd::enable;
+  msg.duration = duration;
+  msg.clock_pin = 2;
+  msg.data_pin = 3;
+  send_frame(&msg, sizeof(MarkerDataEnable));
+  return reply_error();
+}
+
+static bool health(uint8_t port, uint8_t address, ModIODataHealth* health)
+{
+  ModIOData msg;
+  std::vector<uint8_t> frame;
+
+  msg.header.code = HostCode::modio_board;
+  msg.port = port;
+  msg.address = address;
+  msg.cmd = ModIOCmd::health;
+  send_frame(&msg, sizeof(ModIOData));
+  frame = reply();
+  if (frame.size() != sizeof(ModIODataHealth))
+    return false;
+  memcpy(health, frame.data(), sizeof(ModIODataHealth));
+  return true;
+}
+
+static HostError remove(uint8_t port, uint8_t address)
+{
+  ModIOData msg;
+
+  msg.header.code = HostCode::modio_board;
+  msg.port = port;
+  msg.address = address;
+  msg.cmd = ModIOCmd::remove;
+  send_frame(&msg, sizeof(ModIOData));
+  return reply_error();
+}
+
+static bool check(bool ok, const char* what)
+{
+  if (!ok)
+    printf("failed: %s\n", what);
+  return ok;
+}
+
+
+// creates that don't fit the queue pool must not use up the board slots. The deep creates each take just over
+// half the pool, or as much as a create can ask for, so a few fill it whatever its size and leave some room
+static bool check_pool_exhausted()
+{
+  uint16_t deep_n = I2C_REQUEST_POOL_N / 2 + 1 > 2 * 255 ? 2 * 255 : I2C_REQUEST_POOL_N / 2 + 1;
+  uint8_t deep_q;
+  uint8_t deep_u;
+  uint8_t fit;
+  uint8_t i = 0;
+  bool ok = true;
+
+  if (I2C_REQUEST_POOL_N % deep_n < 2)
+    deep_n--;
+  deep_q = deep_n - deep_n / 2;
+  deep_u = deep_n / 2;
+  fit = I2C_REQUEST_POOL_N / deep_n;
+
+  for (; i < fit; i++)
+    ok &= check(create(0, 0x20 + i, deep_q, deep_u, 0) == HostError::no_error, "deep create that fits");
+  for (; i < NUM_MODIO_BOARDS_MAX; i++)
+    ok &= check(create(i % 3, 0x20 + i, deep_q, deep_u, 0) == HostError::no_resource, "deep create that doesn't fit");
+
+  ok &= check(create(1, 0x60, 1, 1, 0) == HostError::no_error, "small create after the failed ones");
+  ok &= check(remove(2, 0x20 + NUM_MODIO_BOARDS_MAX - 1) == HostError::not_found, "remove of a board that failed to create");
+  ok &= check(remove(0, 0x20) == HostError::no_error, "remove of a deep board");
+  ok &= check(create(0, 0x20, deep_q, deep_u, 0) == HostError::no_error, "deep create once the pool is free again");
+  return ok;
+}
+
+// a board that NAKs fails on its own, without the port being recovered under the other boards
+static bool check_nak_keeps_bus()
+{
+  ModIODataHealth state;
+  uint64_t scl_toggles;
+  uint8_t i = 0;
+  bool ok = true;
+
+  Master.sim_add_modio(0x21);
+  ok &= check(create(0, 0x20, 0, 0, 2000) == HostError::no_error, "create of the missing board");
+  ok &= check(create(0, 0x21, 0, 0, 2000) == HostError::no_error, "create of the present board");
+  scl_toggles = sim::pin_toggles(19);
+
+  for (; i < 2 * I2C_RECOVER_FAILURES; i++)
+    ok &= check(read_dig(0, 0x20) == HostError::i2c_teensy_error, "read of the missing board NAKs");
+  ok &= check(health(0, 0x20, &state), "health of the missing board");
+  ok &= check(state.health == ModIOHealth::failed, "missing board failed");
+  ok &= check(state.recoveries == 0, "no recovery for NAKs");
+  ok &= check(sim::pin_toggles(19) == scl_toggles, "SCL not clocked for NAKs");
+  ok &= check(read_dig(0, 0x21) == HostError::no_error, "read of the present board");
+  return ok;
+}
+
+// a slave holding SDA low times out the transactions until the port is recovered
+static bool check_stuck_recovers()
+{
+  ModIODataHealth state;
+  uint8_t i = 0;
+  bool ok = true;
+
+  Master.sim_add_modio(0x20)->stuck = true;
+  ok &= check(create(0, 0x20, 0, 0, 2000) == HostError::no_error, "create");
+
+  for (; i < I2C_RECOVER_FAILURES; i++)
+    ok &= check(read_dig(0, 0x20) == HostError::timed_out, "read while SDA is held low");
+  ok &= check(!Master.sim_stuck(), "SDA released");
+  ok &= check(read_dig(0, 0x20) == HostError::no_error, "read after the recovery");
+  ok &= check(health(0, 0x20, &state), "health");
+  ok &= check(state.health == ModIOHealth::ok, "board ok again");
+  ok &= check(state.recoveries == 1, "one recovery");
+  return ok;
+}
+
+// masked writes around a pulse train merge with the relays the host queued, not with the train's edges
+static bool check_pulse_relays()
+{
+  SimModIO* modio = Master.sim_add_modio(0x20);
+  bool ok = true;
+
+  ok &= check(create(0, 0x20, 0, 0, 0) == HostError::no_error, "create");
+  ok &= check(write_mask(0, 0x20, 0x04, 0x04) == HostError::no_error, "write before the train");
+  ok &= check(pulse(0, 0x20, 0x01, 1000, 1000, 3) == HostError::no_error, "first edge of the train");
+  ok &= check(modio->relays == 0x05, "first edge opens the pulsed relay");
+  ok &= check(write_mask(0, 0x20, 0x03, 0x03) == HostError::no_error, "write during the train");
+  ok &= check((modio->relays & 0x06) == 0x06, "write during the train keeps the other relays");
+
+  run_us(10000);
+  ok &= check(modio->relays == 0x06, "train leaves its relay closed");
+  ok &= check(write_mask(0, 0x20, 0x08, 0x08) == HostError::no_error, "write after the train");
+  ok &= check(modio->relays == 0x0E, "write after the train keeps the queued relays");
+  return ok;
+}
+
+// a read whose marker code doesn't fit the marker's queue is still sent, and the continuous read goes on
+static bool check_marker_overflow()
+{
+  SimModIO* modio = Master.sim_add_modio(0x20);
+  std::vector<std::vector<uint8_t>> frames;
+  HostData* header;
+  uint32_t reads = 0;
+  uint32_t overflows = 0;
+  uint8_t i = 0;
+  bool ok = true;
+
+  ok &= check(create(0, 0x20, 0, 0, 0) == HostError::no_error, "create");
+  // codes that take most of a second each, so the queue fills up
+  ok &= check(marker_enable(50000) == HostError::no_error, "marker enable");
+  ok &= check(read_cont(0, 0x20, 500) == HostError::no_error, "first continuous read");
+
+  for (; i < 2 * MARKER_QUEUE_N; i++)
+  {
+    modio->inputs ^= 0x01;
+    frames = run_us(2000);
+    for (auto& frame : frames)
+    {
+      header = (HostData*)frame.data();
+      if (header->code != HostCode::modio_board || ((ModIOData*)header)->cmd != ModIOCmd::read_dig_cont_start)
+        continue;
+      if (header->err == HostError::overflow && header->len == sizeof(ModIOData))
+        overflows++;
+      else if (header->err == HostError::no_error && ((ModIODataBuff*)header)->value == modio->inputs)
+        reads++;
+    }
+  }
+
+  ok &= check(overflows > 0, "marker queue overflowed");
+  ok &= check(reads == 2 * MARKER_QUEUE_N, "every change read after the overflow");
+  return ok;
+}
+
+// a queued continuous read keeps its settings until it starts, and one that didn't start yet is replaced
+static bool check_poll_settings_queued()
+{
+  ModIODataCont cont;
+  ModIOData stats;
+  std::vector<std::vector<uint8_t>> frames;
+  HostData* header;
+  uint8_t first_id;
+  uint32_t interval_us = 0;
+  bool coalesced = false;
+  bool ok = true;
+
+  Master.sim_add_modio(0x20);
+  ok &= check(create(0, 0x20, 4, 1, 0) == HostError::no_error, "create with room for the queued starts");
+  ok &= check(read_cont(0, 0x20, 1000) == HostError::no_error, "running continuous read");
+
+  // both starts wait behind a read, and the stats are answered before either starts
+  stats.header.code = HostCode::modio_board;
+  stats.port = 0;
+  stats.address = 0x20;
+  stats.cmd = ModIOCmd::read_dig;
+  send_frame(&stats, sizeof(ModIOData));
+  cont.header.header.code = HostCode::modio_board;
+  cont.header.port = 0;
+  cont.header.address = 0x20;
+  cont.header.cmd = ModIOCmd::read_dig_cont_start;
+  cont.interval_us = 50000;
+  send_frame(&cont, sizeof(ModIODataCont));
+  first_id = next_id - 1;
+  cont.interval_us = 20000;
+  send_frame(&cont, sizeof(ModIODataCont));
+  stats.cmd = ModIOCmd::poll_stats;
+  send_frame(&stats, sizeof(ModIOData));
+
+  frames = run_us(5000);
+  for (auto& frame : frames)
+  {
+    header = (HostData*)frame.data();
+    if (header->id == first_id && header->err == HostError::coalesced)
+      coalesced = true;
+    if (header->id == (uint8_t)(next_id - 1) && frame.size() == sizeof(ModIODataPollStats))
+      interval_us = ((ModIODataPollStats*)header)->interval_us;
+  }
+  ok &= check(coalesced, "waiting start acked as coalesced");
+  ok &= check(interval_us == 1000, "running read keeps its interval until the next one starts");
+
+  send_frame(&stats, sizeof(ModIOData));
+  frames = run_us(1000);
+  interval_us = 0;
+  for (auto& frame : frames)
+    if (frame.size() == sizeof(ModIODataPollStats))
+      interval_us = ((ModIODataPollStats*)frame.data())->interval_us;
+  ok &= check(interval_us == 20000, "latest start's interval once it started");
+  return ok;
+}
+
+// removing a board answers what it had queued and its running continuous read, instead of dropping them
+static bool check_remove_answers_waiting()
+{
+  ModIOData msg;
+  std::vector<std::vector<uint8_t>> frames;
+  HostData* header;
+  uint8_t cont_id;
+  uint8_t first_id;
+  uint32_t answered = 0;
+  bool ok = true;
+
+  Master.sim_add_modio(0x20);
+  ok &= check(create(0, 0x20, 0, 0, 0) == HostError::no_error, "create");
+  ok &= check(read_cont(0, 0x20, 100000) == HostError::no_error, "continuous read");
+  cont_id = next_id - 1;
+
+  // the reads are still queued when the remove is handled
+  msg.header.code = HostCode::modio_board;
+  msg.port = 0;
+  msg.address = 0x20;
+  msg.cmd = ModIOCmd::read_dig;
+  first_id = next_id;
+  send_frame(&msg, sizeof(ModIOData));
+  send_frame(&msg, sizeof(ModIOData));
+  send_frame(&msg, sizeof(ModIOData));
+  msg.cmd = ModIOCmd::remove;
+  send_frame(&msg, sizeof(ModIOData));
+
+  frames = run_us(5000);
+  for (auto& frame : frames)
+  {
+    header = (HostData*)frame.data();
+    if (header->code != HostCode::modio_board)
+      continue;
+    if ((header->id == cont_id || (header->id >= first_id && header->id < first_id + 3))
+        && header->err == HostError::not_found)
+      answered++;
+    if (header->id == first_id + 3)
+      ok &= check(header->err == HostError::no_error, "remove");
+  }
+  ok &= check(answered == 4, "queued reads and the continuous read answered");
+  return ok;
+}
+
+// a frame dropped for a full TX ring is named by its own code and id, also when the journal wraps it
+static bool check_drop_names_frame()
+{
+  HostDataJournal journal;
+  HostData echo;
+  std::vector<std::vector<uint8_t>> frames;
+  HostData* header;
+  uint32_t drops = 0;
+  uint32_t i = 0;
+  bool ok = true;
+
+  journal.header.code = HostCode::journal;
+  journal.cmd = JournalCmd::enable;
+  send_frame(&journal, sizeof(HostDataJournal));
+  ok &= check(reply_error() == HostError::no_error, "journal enable");
+
+  // nothing is read meanwhile, so the serial port and then the TX ring fill up
+  echo.code = HostCode::echo;
+  for (; i < 1000; i++)
+  {
+    send_frame(&echo, sizeof(HostData));
+    if (i % 20 == 19)
+      loop();
+  }
+
+  frames = run_us(100000);
+  for (auto& frame : frames)
+  {
+    header = (HostData*)frame.data();
+    if (header->err != HostError::dropping_data)
+      continue;
+    drops++;
+    ok &= check(header->code == HostCode::echo, "drop notice names the echo, not the journal event");
+  }
+  ok &= check(drops > 0, "echoes dropped");
+  return ok;
+}
+
+
+int main(int argc, char** argv)
+{
+  const char* name = argc > 1 ? argv[1] : "";
+  bool ok;
+
+  sim::reset();
+  sim::use_virtual_clock(true);
+  setup();
+
+  if (strcmp(name, "pool_exhausted") == 0)
+    ok = check_pool_exhausted();
+  else if (strcmp(name, "nak_keeps_bus") == 0)
+    ok = check_nak_keeps_bus();
+  else if (strcmp(name, "stuck_recovers") == 0)
+    ok = check_stuck_recovers();
+  else if (strcmp(name, "pulse_relays") == 0)
+    ok = check_pulse_relays();
+  else if (strcmp(name, "marker_overflow") == 0)
+    ok = check_marker_overflow();
+  else if (strcmp(name, "poll_settings_queued") == 0)
+    ok = check_poll_settings_queued();
+  else if (strcmp(name, "remove_answers_waiting") == 0)
+    ok = check_remove_answers_waiting();
+  else if (strcmp(name, "drop_names_frame") == 0)
+    ok = check_drop_names_frame();
+  else
+  {
+    fprintf(stderr, "unknown check \"%s\"\n", name);
+    return 2;
+  }
+
+  printf("%s: %s\n", name, ok ? "ok" : "failed");
+  return ok ? 0 : 1;
+}